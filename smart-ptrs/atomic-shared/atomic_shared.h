@@ -0,0 +1,176 @@
+#pragma once
+
+#include <shared-from-this/shared.h>
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <utility>
+
+// Lock-free atomic `SharedPtr` with split reference counts.
+//
+// The stored value lives in an immutable node, a `Block<SharedPtr<T>>` created by every store. The
+// node pointer and a 16-bit "local" count share one word: a reader bumps the local count with the
+// same RMW that reads the pointer, so the node cannot die under it, copies the value out and then
+// gives the local reference back. A reader that comes back after a writer swapped the node out
+// releases one of the node's ordinary strong references instead. Readers never wait for writers or
+// each other.
+//
+// The slot owns `kSlotRefs` strong references of its node, more than the local count can ever
+// hold. A writer that swaps the node out drops all of them except one per local reference it finds
+// in the word, so the node lives until the last late reader is done, in whatever order they come
+// back.
+//
+// Limits: node addresses must fit into the low 48 bits, which rules out 5-level paging (LA57) with
+// a heap above 2^47 and tagged-pointer heaps (ARM TBI/MTE, HWASan); debug builds check every node.
+// At most `kMaxReaders` - 1 `Load`s and `CompareExchange`s may be in flight on one slot at a time,
+// one more wraps the local count around into nothing.
+template <typename T>
+class AtomicSharedPtr {
+public:
+    AtomicSharedPtr() = default;
+
+    AtomicSharedPtr(SharedPtr<T> value) : word_(Pack(MakeNode(std::move(value)))) {
+    }
+
+    AtomicSharedPtr(const AtomicSharedPtr&) = delete;
+    AtomicSharedPtr& operator=(const AtomicSharedPtr&) = delete;
+
+    ~AtomicSharedPtr() {
+        ReleaseNode(word_.load(std::memory_order_acquire));
+    }
+
+    SharedPtr<T> Load() const {
+        uint64_t word = word_.fetch_add(kLocalRef, std::memory_order_acquire);
+        Node* node = NodeOf(word);
+        SharedPtr<T> value;
+        if (node) {
+            value = *node->GetPtr();
+        }
+        ReleaseLocal(node);
+        return value;
+    }
+
+    void Store(SharedPtr<T> desired) {
+        ReleaseNode(word_.exchange(Pack(MakeNode(std::move(desired))), std::memory_order_acq_rel));
+    }
+
+    SharedPtr<T> Exchange(SharedPtr<T> desired) {
+        uint64_t word =
+            word_.exchange(Pack(MakeNode(std::move(desired))), std::memory_order_acq_rel);
+        SharedPtr<T> previous;
+        if (Node* node = NodeOf(word)) {
+            previous = *node->GetPtr();
+        }
+        ReleaseNode(word);
+        return previous;
+    }
+
+    // Replaces the value if it still shares ownership with `expected` and points to the same
+    // object. Otherwise loads the current value into `expected` and returns false.
+    bool CompareExchange(SharedPtr<T>& expected, SharedPtr<T> desired) {
+        Node* replacement = nullptr;
+        while (true) {
+            uint64_t word = word_.fetch_add(kLocalRef, std::memory_order_acquire);
+            Node* node = NodeOf(word);
+            if (!Equals(node, expected)) {
+                expected = node ? *node->GetPtr() : SharedPtr<T>();
+                ReleaseLocal(node);
+                ReleaseNode(Pack(replacement));
+                return false;
+            }
+            if (!replacement) {
+                replacement = MakeNode(std::move(desired));
+            }
+            word += kLocalRef;
+            while (NodeOf(word) == node) {
+                if (word_.compare_exchange_weak(word, Pack(replacement),
+                                                std::memory_order_acq_rel)) {
+                    // Our own local reference is part of `word`, drop it along with the slot's.
+                    ReleaseNode(word, 1);
+                    return true;
+                }
+            }
+            // Somebody stored in between; the new value may still be equal, so look again.
+            ReleaseLocal(node);
+        }
+    }
+
+    // The local count has 16 bits, see the class comment.
+    static constexpr uint64_t kMaxReaders = uint64_t{1} << 16;
+
+    static constexpr bool IsLockFree() {
+        return std::atomic<uint64_t>::is_always_lock_free;
+    }
+
+private:
+    using Node = Block<SharedPtr<T>>;
+
+    // Only 64-bit targets with untagged 48-bit user-space addresses (x86-64 with 4-level paging,
+    // AArch64 without top-byte tags) are supported.
+    static_assert(sizeof(void*) == sizeof(uint64_t), "AtomicSharedPtr needs 64-bit pointers");
+    static constexpr int kPointerBits = 48;
+    static constexpr uint64_t kLocalRef = uint64_t{1} << kPointerBits;
+    static constexpr uint64_t kPointerMask = kLocalRef - 1;
+    static constexpr uint64_t kSlotRefs = uint64_t{1} << (64 - kPointerBits);
+    static_assert(kSlotRefs == kMaxReaders);
+
+    static Node* MakeNode(SharedPtr<T> value) {
+        if (!value.GetBlock() && !value.Get()) {
+            return nullptr;
+        }
+        auto node = new Node(std::move(value));
+        node->template AddStrongRef<AtomicPolicy>(kSlotRefs);
+        return node;
+    }
+
+    static uint64_t Pack(Node* node) {
+        uint64_t word = reinterpret_cast<uintptr_t>(node);
+        assert((word & ~kPointerMask) == 0 && "AtomicSharedPtr: node address exceeds 48 bits");
+        return word;
+    }
+
+    static Node* NodeOf(uint64_t word) {
+        return reinterpret_cast<Node*>(word & kPointerMask);
+    }
+
+    static uint64_t LocalCount(uint64_t word) {
+        return word >> kPointerBits;
+    }
+
+    static bool Equals(Node* node, const SharedPtr<T>& expected) {
+        if (!node) {
+            return !expected.GetBlock() && !expected.Get();
+        }
+        const SharedPtr<T>& value = *node->GetPtr();
+        return value.GetBlock() == expected.GetBlock() && value.Get() == expected.Get();
+    }
+
+    // Gives back a local reference taken on `node`, or the strong reference it was turned into if
+    // the node has been swapped out meanwhile. Local counts taken on an empty slot are simply left
+    // behind: they only wrap around within their own bits and the next store discards them.
+    void ReleaseLocal(Node* node) const {
+        if (!node) {
+            return;
+        }
+        uint64_t word = word_.load(std::memory_order_relaxed);
+        while (NodeOf(word) == node) {
+            if (word_.compare_exchange_weak(word, word - kLocalRef, std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+                return;
+            }
+        }
+        node->template DecStrongRef<AtomicPolicy>();
+    }
+
+    // `word` was just swapped out of the slot: every reader still holding a local reference will
+    // release one strong reference, the rest of the slot's references (less `extra` local ones
+    // the caller holds itself) go now.
+    static void ReleaseNode(uint64_t word, uint64_t extra = 0) {
+        if (Node* node = NodeOf(word)) {
+            node->template DecStrongRef<AtomicPolicy>(kSlotRefs - LocalCount(word) + extra);
+        }
+    }
+
+    mutable std::atomic<uint64_t> word_ = 0;
+};
@@ -0,0 +1,77 @@
+#include "atomic_shared.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+constexpr int kReads = 2'000'000;
+constexpr auto kWriteInterval = std::chrono::microseconds(50);
+
+class MutexSharedPtr {
+public:
+    explicit MutexSharedPtr(SharedPtr<int> value) : value_(std::move(value)) {
+    }
+
+    SharedPtr<int> Load() const {
+        std::lock_guard lock(mutex_);
+        return value_;
+    }
+
+    void Store(SharedPtr<int> desired) {
+        std::lock_guard lock(mutex_);
+        value_.Swap(desired);
+    }
+
+private:
+    mutable std::mutex mutex_;
+    SharedPtr<int> value_;
+};
+
+// `readers` threads load the pointer in a loop while one writer replaces it every
+// `kWriteInterval`. Reports the mean time per read.
+template <class Slot>
+void Measure(const char* name, int readers) {
+    Slot slot(MakeShared<int>(0));
+    std::atomic<bool> done = false;
+    std::thread writer([&] {
+        for (int i = 1; !done.load(std::memory_order_relaxed); ++i) {
+            slot.Store(MakeShared<int>(i));
+            std::this_thread::sleep_for(kWriteInterval);
+        }
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < readers; ++i) {
+        threads.emplace_back([&] {
+            for (int j = 0; j < kReads; ++j) {
+                SharedPtr<int> value = slot.Load();
+                asm volatile("" : : "r"(value.Get()) : "memory");
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    done = true;
+    writer.join();
+
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    std::printf("%-20s %2d readers %8.2f ns/read\n", name, readers,
+                static_cast<double>(ns) / kReads);
+}
+
+int main() {
+    int max_readers = std::max(4, static_cast<int>(std::thread::hardware_concurrency()));
+    for (int readers = 1; readers <= max_readers; readers *= 2) {
+        Measure<MutexSharedPtr>("mutex + SharedPtr", readers);
+        Measure<AtomicSharedPtr<int>>("AtomicSharedPtr", readers);
+    }
+}
@@ -0,0 +1,133 @@
+#include "atomic_shared.h"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Counted {
+    explicit Counted(int value) : value(value) {
+        ++alive;
+    }
+
+    ~Counted() {
+        --alive;
+    }
+
+    int value;
+
+    static inline std::atomic<int> alive = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Empty") {
+    AtomicSharedPtr<int> a;
+    REQUIRE(a.Load().Get() == nullptr);
+    REQUIRE(a.Load().UseCount() == 0);
+    static_assert(AtomicSharedPtr<int>::IsLockFree());
+}
+
+TEST_CASE("Load and store") {
+    {
+        auto first = MakeShared<Counted>(1);
+        AtomicSharedPtr<Counted> a(first);
+        REQUIRE(first.UseCount() == 2);
+
+        SharedPtr<Counted> loaded = a.Load();
+        REQUIRE(loaded.Get() == first.Get());
+        REQUIRE(first.UseCount() == 3);
+
+        a.Store(MakeShared<Counted>(2));
+        REQUIRE(first.UseCount() == 2);
+        REQUIRE(a.Load()->value == 2);
+        REQUIRE(Counted::alive == 2);
+
+        a.Store(nullptr);
+        REQUIRE(a.Load().Get() == nullptr);
+        REQUIRE(Counted::alive == 1);
+    }
+    REQUIRE(Counted::alive == 0);
+}
+
+TEST_CASE("Exchange") {
+    {
+        AtomicSharedPtr<Counted> a(MakeShared<Counted>(1));
+        SharedPtr<Counted> previous = a.Exchange(MakeShared<Counted>(2));
+        REQUIRE(previous->value == 1);
+        REQUIRE(previous.UseCount() == 1);
+        REQUIRE(a.Load()->value == 2);
+    }
+    REQUIRE(Counted::alive == 0);
+}
+
+TEST_CASE("CompareExchange") {
+    {
+        auto first = MakeShared<Counted>(1);
+        AtomicSharedPtr<Counted> a(first);
+
+        SharedPtr<Counted> expected = MakeShared<Counted>(1);
+        REQUIRE(!a.CompareExchange(expected, MakeShared<Counted>(2)));
+        REQUIRE(expected == first);
+        REQUIRE(a.Load() == first);
+
+        REQUIRE(a.CompareExchange(expected, MakeShared<Counted>(3)));
+        REQUIRE(a.Load()->value == 3);
+        REQUIRE(first.UseCount() == 2);
+
+        SharedPtr<Counted> empty;
+        REQUIRE(!a.CompareExchange(empty, nullptr));
+        REQUIRE(a.CompareExchange(empty, nullptr));
+        REQUIRE(a.Load().Get() == nullptr);
+        REQUIRE(empty->value == 3);
+        empty.Reset();
+        expected.Reset();
+        REQUIRE(Counted::alive == 1);
+    }
+    REQUIRE(Counted::alive == 0);
+}
+
+TEST_CASE("Concurrent readers and writers") {
+    constexpr int kReaders = 6;
+    constexpr int kWriters = 2;
+    constexpr int kIterations = 20000;
+
+    {
+        AtomicSharedPtr<Counted> a(MakeShared<Counted>(0));
+        std::atomic<int> bad_reads = 0;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kReaders; ++i) {
+            threads.emplace_back([&] {
+                for (int j = 0; j < kIterations; ++j) {
+                    SharedPtr<Counted> value = a.Load();
+                    if (!value || value->value < 0) {
+                        ++bad_reads;
+                    }
+                }
+            });
+        }
+        for (int i = 0; i < kWriters; ++i) {
+            threads.emplace_back([&, i] {
+                for (int j = 0; j < kIterations; ++j) {
+                    if (j % 2) {
+                        a.Store(MakeShared<Counted>(j));
+                    } else {
+                        SharedPtr<Counted> expected = a.Load();
+                        while (!a.CompareExchange(expected, MakeShared<Counted>(i))) {
+                        }
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(bad_reads == 0);
+        REQUIRE(Counted::alive == 1);
+        REQUIRE(a.Load().UseCount() == 2);
+    }
+    REQUIRE(Counted::alive == 0);
+}
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Biased reference counting (Choi, Shull, Torrellas, PACT'18).
+//
+// The thread that creates the object owns a non-atomic "biased" counter, every other thread uses
+// an atomic "shared" counter. The object is alive while `biased + shared > 0`, but only the owner
+// can read `biased` cheaply, so the two halves are merged:
+//  * when the owner drops its biased counter to zero, it sets the MERGED flag and from then on
+//    everybody uses the shared counter;
+//  * when another thread drives the shared counter below zero, the owner may be holding the last
+//    references on paper only, so the counter is pushed to the owner's queue (QUEUED flag) and the
+//    owner folds `biased` into `shared` at its next safe point;
+//  * if the owner thread is already gone, the thread that would have queued the counter merges it.
+// Destruction is only ever decided on the shared word, so a counter that is QUEUED is left alone
+// until the merge.
+
+class BiasedCounter;
+
+// Per-thread record identifying the owner. It outlives its thread while counters still point to
+// it, so its address is never reused for another thread.
+class BiasedOwner {
+public:
+    // The record of the calling thread, or nullptr if it never created a biased counter.
+    static BiasedOwner* Current() {
+        return current;
+    }
+
+    // The record of the calling thread, created on first use. Adds a reference.
+    static BiasedOwner* Acquire() {
+        if (!current) {
+            current = new BiasedOwner();
+            guard.owner = current;
+        }
+        current->refs_.fetch_add(1, std::memory_order_relaxed);
+        return current;
+    }
+
+    void Release() {
+        if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+    bool HasQueued() const {
+        BiasedCounter* head = queue_.load(std::memory_order_relaxed);
+        return head && head != Closed();
+    }
+
+    // Returns false if the owner thread has already exited.
+    bool Push(BiasedCounter* counter);
+
+    // Merges every queued counter. Must be called on the owner thread.
+    void MergeQueued() {
+        MergeList(queue_.exchange(nullptr, std::memory_order_acquire));
+    }
+
+private:
+    struct Guard {
+        ~Guard() {
+            if (owner) {
+                current = nullptr;
+                owner->MergeList(owner->queue_.exchange(Closed(), std::memory_order_acq_rel));
+                owner->Release();
+            }
+        }
+
+        BiasedOwner* owner = nullptr;
+    };
+
+    BiasedOwner() = default;
+
+    static BiasedCounter* Closed() {
+        return reinterpret_cast<BiasedCounter*>(uintptr_t{1});
+    }
+
+    static void MergeList(BiasedCounter* head);
+
+    // One reference belongs to the thread itself and is dropped by `Guard`.
+    std::atomic<size_t> refs_ = 1;
+    std::atomic<BiasedCounter*> queue_ = nullptr;
+
+    static thread_local BiasedOwner* current;
+    static thread_local Guard guard;
+};
+
+inline thread_local BiasedOwner* BiasedOwner::current = nullptr;
+inline thread_local BiasedOwner::Guard BiasedOwner::guard;
+
+class BiasedCounter {
+public:
+    using ZeroCallback = void (*)(BiasedCounter* counter);
+
+    // `on_zero` is called when a merge discovers that the last reference is gone. Starts at zero
+    // references, owned by the calling thread.
+    explicit BiasedCounter(ZeroCallback on_zero)
+        : owner_(BiasedOwner::Acquire()), on_zero_(on_zero) {
+    }
+
+    BiasedCounter(const BiasedCounter&) = delete;
+    BiasedCounter& operator=(const BiasedCounter&) = delete;
+
+    ~BiasedCounter() {
+        owner_->Release();
+    }
+
+    void Increment() {
+        if (IsOwner()) {
+            biased_.store(biased_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        } else {
+            shared_.fetch_add(kUnit, std::memory_order_relaxed);
+        }
+    }
+
+    // Returns true if the caller released the last reference and has to destroy the object.
+    bool Decrement() {
+        if (IsOwner()) {
+            uint32_t biased = biased_.load(std::memory_order_relaxed) - 1;
+            biased_.store(biased, std::memory_order_relaxed);
+            if (biased) {
+                if (owner_->HasQueued()) [[unlikely]] {
+                    owner_->MergeQueued();
+                }
+                return false;
+            }
+            merged_ = true;
+            int64_t previous = shared_.fetch_or(kMerged, std::memory_order_acq_rel);
+            return Count(previous) == 0 && !(previous & kQueued);
+        }
+
+        int64_t value = shared_.fetch_sub(kUnit, std::memory_order_acq_rel) - kUnit;
+        if (value & kMerged) {
+            return Count(value) == 0 && !(value & kQueued);
+        }
+        while (Count(value) < 0 && !(value & (kQueued | kMerged))) {
+            if (shared_.compare_exchange_weak(value, value | kQueued, std::memory_order_acq_rel)) {
+                if (!owner_->Push(this)) {
+                    Merge();
+                }
+                break;
+            }
+        }
+        return false;
+    }
+
+    // Used to promote weak references: fails once the count is known to be zero.
+    bool IncrementIfNonZero() {
+        if (IsOwner()) {
+            // Not merged yet, so the owner still holds a reference.
+            Increment();
+            return true;
+        }
+        int64_t value = shared_.load(std::memory_order_relaxed);
+        while (!((value & kMerged) && Count(value) == 0)) {
+            if (shared_.compare_exchange_weak(value, value + kUnit, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Approximate, like every use count read from another thread.
+    int UseCount() const {
+        return static_cast<int>(biased_.load(std::memory_order_relaxed) +
+                                Count(shared_.load(std::memory_order_relaxed)));
+    }
+
+private:
+    friend class BiasedOwner;
+
+    static constexpr int64_t kMerged = 1;
+    static constexpr int64_t kQueued = 2;
+    static constexpr int64_t kUnit = 4;
+
+    static int64_t Count(int64_t value) {
+        return value >> 2;
+    }
+
+    // `merged_` belongs to the owner, so it is only read once the thread is known to be the owner.
+    bool IsOwner() const {
+        return owner_ == BiasedOwner::Current() && !merged_;
+    }
+
+    // Folds the biased counter into the shared one. Runs on the owner thread, or on the thread that
+    // found the owner gone (then `biased_` can no longer change).
+    void Merge() {
+        int64_t biased = biased_.load(std::memory_order_relaxed);
+        biased_.store(0, std::memory_order_relaxed);
+        merged_ = true;
+        int64_t value = shared_.load(std::memory_order_relaxed);
+        int64_t desired;
+        do {
+            desired = ((value + biased * kUnit) | kMerged) & ~kQueued;
+        } while (!shared_.compare_exchange_weak(value, desired, std::memory_order_acq_rel));
+        if (Count(desired) == 0) {
+            on_zero_(this);
+        }
+    }
+
+    BiasedOwner* owner_;
+    std::atomic<uint32_t> biased_ = 0;
+    // Only touched by the owner thread (or after it is gone).
+    bool merged_ = false;
+    std::atomic<int64_t> shared_ = 0;
+    BiasedCounter* next_ = nullptr;
+    ZeroCallback on_zero_;
+};
+
+inline bool BiasedOwner::Push(BiasedCounter* counter) {
+    BiasedCounter* head = queue_.load(std::memory_order_relaxed);
+    do {
+        if (head == Closed()) {
+            return false;
+        }
+        counter->next_ = head;
+    } while (!queue_.compare_exchange_weak(head, counter, std::memory_order_release,
+                                           std::memory_order_acquire));
+    return true;
+}
+
+inline void BiasedOwner::MergeList(BiasedCounter* head) {
+    while (head && head != Closed()) {
+        BiasedCounter* next = head->next_;
+        head->Merge();
+        head = next;
+    }
+}
+
+// Safe point for the calling thread: merges the counters other threads queued for it.
+inline void MergeBiasedCounters() {
+    if (auto owner = BiasedOwner::Current(); owner && owner->HasQueued()) {
+        owner->MergeQueued();
+    }
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Opt-in deferral of reference count decrements.
+//
+// Inside a `DeferredReleaseScope` smart pointers do not decrement their target's counter. They put
+// it into a small thread-local table instead, where releases of the same object are coalesced into
+// one entry with a count. The table is applied when the outermost scope ends, at
+// `FlushDeferredReleases()`, or entry by entry when a slot is needed for another object. Objects
+// therefore die at the flush rather than inline.
+class DeferredReleases {
+public:
+    // Drops `count` references of `object`.
+    using ReleaseFn = void (*)(void* object, size_t count);
+
+    static bool Active() {
+        return depth > 0;
+    }
+
+    static void Push(void* object, ReleaseFn release) {
+        Entry& entry = table.entries[Slot(object)];
+        if (entry.object == object && entry.release == release) {
+            ++entry.count;
+            return;
+        }
+        if (entry.object) {
+            Entry evicted = entry;
+            entry = Entry{object, release, 1};
+            evicted.release(evicted.object, evicted.count);
+            return;
+        }
+        entry = Entry{object, release, 1};
+    }
+
+    static void Flush() {
+        // Releasing an object may release (and push) others, so every entry is taken out of the
+        // table before it is applied.
+        for (bool pushed = true; pushed;) {
+            pushed = false;
+            for (Entry& slot : table.entries) {
+                if (slot.object) {
+                    Entry entry = slot;
+                    slot = Entry{};
+                    entry.release(entry.object, entry.count);
+                    pushed = true;
+                }
+            }
+        }
+    }
+
+private:
+    friend class DeferredReleaseScope;
+
+    static constexpr size_t kSlots = 64;
+
+    struct Entry {
+        void* object = nullptr;
+        ReleaseFn release = nullptr;
+        size_t count = 0;
+    };
+
+    struct Table {
+        ~Table() {
+            Flush();
+        }
+
+        Entry entries[kSlots];
+    };
+
+    static size_t Slot(void* object) {
+        auto address = reinterpret_cast<uintptr_t>(object);
+        return ((address >> 4) ^ (address >> 10)) % kSlots;
+    }
+
+    static thread_local size_t depth;
+    static thread_local Table table;
+};
+
+inline thread_local size_t DeferredReleases::depth = 0;
+inline thread_local DeferredReleases::Table DeferredReleases::table;
+
+// Defers decrements made on this thread until the outermost scope ends.
+class DeferredReleaseScope {
+public:
+    DeferredReleaseScope() {
+        ++DeferredReleases::depth;
+    }
+
+    DeferredReleaseScope(const DeferredReleaseScope&) = delete;
+    DeferredReleaseScope& operator=(const DeferredReleaseScope&) = delete;
+
+    ~DeferredReleaseScope() {
+        if (!--DeferredReleases::depth) {
+            DeferredReleases::Flush();
+        }
+    }
+};
+
+// Safe point inside a scope: applies everything deferred so far.
+inline void FlushDeferredReleases() {
+    DeferredReleases::Flush();
+}
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <mutex>
+#include <new>
+
+// Per-thread caches ("magazines") of small memory chunks, one per size class.
+//
+// Chunks are carved from 64 KiB pages aligned to their size; the page header names the thread
+// heap that owns the page and the size class of its chunks. Allocation pops from the calling
+// thread's list for the class without any atomic operation. A chunk freed by its owner thread goes
+// straight back to that list; a chunk freed by any other thread is pushed to the owner's
+// remote-free queue, which the owner drains the next time one of its lists runs empty. Nobody
+// takes a lock on the hot paths, and memory allocated in one thread and released in another never
+// touches the global allocator.
+//
+// When a thread exits its heap is parked, with all its pages and queued chunks, and handed to the
+// next thread that needs a heap. Allocations made by the thread after that, from destructors of
+// other thread-locals, borrow a parked heap just for the call. Pages are never returned to the
+// system.
+class ThreadHeap {
+public:
+    static constexpr size_t kMaxSize = 1024;
+    static constexpr size_t kAlignment = 16;
+
+    static void* Allocate(size_t bytes) {
+        if (ThreadHeap* heap = Local()) [[likely]] {
+            return heap->Pop(SizeClass(bytes));
+        }
+        ThreadHeap* heap = Adopt();
+        void* ptr = heap->Pop(SizeClass(bytes));
+        Park(heap);
+        return ptr;
+    }
+
+    // Number of heaps waiting for a thread.
+    static size_t ParkedCount() {
+        std::lock_guard lock(parked_mutex);
+        size_t count = 0;
+        for (ThreadHeap* heap = parked; heap; heap = heap->next_parked_) {
+            ++count;
+        }
+        return count;
+    }
+
+    static void Free(void* ptr) {
+        Page* page = PageOf(ptr);
+        auto chunk = static_cast<Chunk*>(ptr);
+        if (page->owner == current) {
+            page->owner->Push(page->size_class, chunk);
+        } else {
+            page->owner->PushRemote(chunk);
+        }
+    }
+
+private:
+    static constexpr size_t kPageBytes = 64 * 1024;
+    static constexpr size_t kClassSizes[] = {16,  32,  48,  64,  80,  96,  112, 128, 160, 192,
+                                             224, 256, 320, 384, 448, 512, 640, 768, 896, 1024};
+    static constexpr size_t kClasses = std::size(kClassSizes);
+
+    struct Chunk {
+        Chunk* next;
+    };
+
+    struct Page {
+        ThreadHeap* owner;
+        size_t size_class;
+    };
+
+    static constexpr size_t kFirstChunk = (sizeof(Page) + kAlignment - 1) / kAlignment * kAlignment;
+
+    // Parks the heap of an exiting thread.
+    struct Guard {
+        ~Guard() {
+            if (current) {
+                ThreadHeap::Park(current);
+                current = nullptr;
+            }
+            exited = true;
+        }
+    };
+
+    static size_t SizeClass(size_t bytes) {
+        if (bytes <= 128) {
+            return bytes ? (bytes - 1) / 16 : 0;
+        }
+        size_t size_class = 8;
+        while (kClassSizes[size_class] < bytes) {
+            ++size_class;
+        }
+        return size_class;
+    }
+
+    static Page* PageOf(void* ptr) {
+        return reinterpret_cast<Page*>(reinterpret_cast<uintptr_t>(ptr) & ~(kPageBytes - 1));
+    }
+
+    // The heap of the thread, or nullptr once the thread has parked it.
+    static ThreadHeap* Local() {
+        if (!current && !exited) [[unlikely]] {
+            current = Adopt();
+            // Registers the thread-exit hook.
+            static thread_local Guard guard;
+        }
+        return current;
+    }
+
+    static ThreadHeap* Adopt() {
+        std::lock_guard lock(parked_mutex);
+        if (ThreadHeap* heap = parked) {
+            parked = heap->next_parked_;
+            return heap;
+        }
+        return new ThreadHeap();
+    }
+
+    static void Park(ThreadHeap* heap) {
+        std::lock_guard lock(parked_mutex);
+        heap->next_parked_ = parked;
+        parked = heap;
+    }
+
+    void Push(size_t size_class, Chunk* chunk) {
+        chunk->next = free_[size_class];
+        free_[size_class] = chunk;
+    }
+
+    void PushRemote(Chunk* chunk) {
+        Chunk* head = remote_.load(std::memory_order_relaxed);
+        do {
+            chunk->next = head;
+        } while (!remote_.compare_exchange_weak(head, chunk, std::memory_order_release,
+                                                std::memory_order_relaxed));
+    }
+
+    void* Pop(size_t size_class) {
+        if (!free_[size_class]) [[unlikely]] {
+            DrainRemote();
+            if (!free_[size_class]) {
+                Refill(size_class);
+            }
+        }
+        Chunk* chunk = free_[size_class];
+        free_[size_class] = chunk->next;
+        return chunk;
+    }
+
+    // Takes the whole queue at once, so the pushers never race with a pop.
+    void DrainRemote() {
+        Chunk* chunk = remote_.exchange(nullptr, std::memory_order_acquire);
+        while (chunk) {
+            Chunk* next = chunk->next;
+            Push(PageOf(chunk)->size_class, chunk);
+            chunk = next;
+        }
+    }
+
+    void Refill(size_t size_class) {
+        void* memory = ::operator new(kPageBytes, std::align_val_t{kPageBytes});
+        new (memory) Page{this, size_class};
+        size_t size = kClassSizes[size_class];
+        char* first = static_cast<char*>(memory) + kFirstChunk;
+        for (size_t offset = (kPageBytes - kFirstChunk) / size * size; offset;) {
+            offset -= size;
+            Push(size_class, reinterpret_cast<Chunk*>(first + offset));
+        }
+    }
+
+    Chunk* free_[kClasses] = {};
+    std::atomic<Chunk*> remote_ = nullptr;
+    ThreadHeap* next_parked_ = nullptr;
+
+    static thread_local ThreadHeap* current;
+    static thread_local bool exited;
+    static ThreadHeap* parked;
+    static std::mutex parked_mutex;
+};
+
+inline thread_local ThreadHeap* ThreadHeap::current = nullptr;
+inline thread_local bool ThreadHeap::exited = false;
+inline ThreadHeap* ThreadHeap::parked = nullptr;
+inline std::mutex ThreadHeap::parked_mutex;
+
+// Standard allocator on top of `ThreadHeap`. Requests that are too large or too aligned for the
+// size classes go to the global allocator.
+template <class T>
+struct MagazineAllocator {
+    using value_type = T;
+
+    MagazineAllocator() = default;
+
+    template <class U>
+    MagazineAllocator(const MagazineAllocator<U>&) {
+    }
+
+    T* allocate(size_t n) {
+        if (UsesMagazines(n)) {
+            return static_cast<T*>(ThreadHeap::Allocate(n * sizeof(T)));
+        }
+        if constexpr (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+            return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t{alignof(T)}));
+        } else {
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+    }
+
+    void deallocate(T* ptr, size_t n) {
+        if (UsesMagazines(n)) {
+            ThreadHeap::Free(ptr);
+        } else if constexpr (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+            ::operator delete(ptr, std::align_val_t{alignof(T)});
+        } else {
+            ::operator delete(ptr);
+        }
+    }
+
+    template <class U>
+    bool operator==(const MagazineAllocator<U>&) const {
+        return true;
+    }
+
+private:
+    static bool UsesMagazines(size_t n) {
+        return n * sizeof(T) <= ThreadHeap::kMaxSize && alignof(T) <= ThreadHeap::kAlignment;
+    }
+};
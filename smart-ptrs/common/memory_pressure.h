@@ -0,0 +1,85 @@
+#pragma once
+
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <utility>
+
+// Reports whether the system is short of memory, from the files the Linux kernel exports.
+//
+// The primary signal is PSI (`/proc/pressure/memory`): the share of the last ten seconds in which
+// some task stalled waiting for memory. Kernels without PSI fall back to the ratio of
+// `MemAvailable` to `MemTotal` in `/proc/meminfo`. Both paths may point to any file, which is how
+// tests and containers with their own cgroup files use it.
+class MemoryPressure {
+public:
+    explicit MemoryPressure(std::string psi_path = "/proc/pressure/memory",
+                            std::string meminfo_path = "/proc/meminfo",
+                            double max_stall_percent = 10.0, double min_available_fraction = 0.1)
+        : psi_path_(std::move(psi_path)),
+          meminfo_path_(std::move(meminfo_path)),
+          max_stall_percent_(max_stall_percent),
+          min_available_fraction_(min_available_fraction) {
+    }
+
+    bool IsHigh() const {
+        if (auto stall = ReadStallPercent(psi_path_)) {
+            return *stall >= max_stall_percent_;
+        }
+        if (auto available = ReadAvailableFraction(meminfo_path_)) {
+            return *available < min_available_fraction_;
+        }
+        return false;
+    }
+
+    // `avg10` of the "some" line of a PSI file.
+    static std::optional<double> ReadStallPercent(const std::string& path) {
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.rfind("some ", 0) != 0) {
+                continue;
+            }
+            auto pos = line.find("avg10=");
+            if (pos == std::string::npos) {
+                return std::nullopt;
+            }
+            std::istringstream value(line.substr(pos + 6));
+            double percent;
+            if (value >> percent) {
+                return percent;
+            }
+            return std::nullopt;
+        }
+        return std::nullopt;
+    }
+
+    // `MemAvailable / MemTotal` of a meminfo file.
+    static std::optional<double> ReadAvailableFraction(const std::string& path) {
+        std::ifstream file(path);
+        std::string key;
+        double total = 0;
+        double available = -1;
+        double value;
+        std::string unit;
+        while (file >> key >> value) {
+            if (key == "MemTotal:") {
+                total = value;
+            } else if (key == "MemAvailable:") {
+                available = value;
+            }
+            std::getline(file, unit);
+        }
+        if (total <= 0 || available < 0) {
+            return std::nullopt;
+        }
+        return available / total;
+    }
+
+private:
+    std::string psi_path_;
+    std::string meminfo_path_;
+    double max_stall_percent_;
+    double min_available_fraction_;
+};
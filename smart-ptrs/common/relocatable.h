@@ -0,0 +1,13 @@
+#pragma once
+
+#include <type_traits>
+
+// A type is trivially relocatable if moving an object to new memory and destroying the source is
+// the same as copying its bytes and forgetting the source. Every smart pointer here qualifies: it
+// holds plain pointers and nothing points back at it. Containers use the trait to grow with
+// `memcpy`/`realloc` instead of an element-wise move and destroy.
+template <class T>
+struct IsTriviallyRelocatable : std::bool_constant<std::is_trivially_copyable_v<T>> {};
+
+template <class T>
+inline constexpr bool kIsTriviallyRelocatable = IsTriviallyRelocatable<T>::value;
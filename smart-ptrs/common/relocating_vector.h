@@ -0,0 +1,166 @@
+#pragma once
+
+#include <common/relocatable.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+// Growable array that relocates trivially relocatable elements with `realloc`: growing a vector
+// of smart pointers copies bytes (or just remaps pages) instead of touching a reference count per
+// element. Other types are moved and destroyed one by one like in `std::vector`.
+template <class T>
+class RelocatingVector {
+    static_assert(alignof(T) <= alignof(std::max_align_t),
+                  "over-aligned elements are not supported");
+
+public:
+    RelocatingVector() = default;
+
+    RelocatingVector(const RelocatingVector&) = delete;
+    RelocatingVector& operator=(const RelocatingVector&) = delete;
+
+    RelocatingVector(RelocatingVector&& other) noexcept
+        : data_(std::exchange(other.data_, nullptr)),
+          size_(std::exchange(other.size_, 0)),
+          capacity_(std::exchange(other.capacity_, 0)) {
+    }
+
+    RelocatingVector& operator=(RelocatingVector&& other) noexcept {
+        if (this != &other) {
+            Clear();
+            std::free(data_);
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+            capacity_ = std::exchange(other.capacity_, 0);
+        }
+        return *this;
+    }
+
+    ~RelocatingVector() {
+        Clear();
+        std::free(data_);
+    }
+
+    template <typename... Args>
+    T& EmplaceBack(Args&&... args) {
+        if (size_ == capacity_) [[unlikely]] {
+            // The arguments may refer to elements that are about to move.
+            T value(std::forward<Args>(args)...);
+            Reserve(capacity_ ? 2 * capacity_ : 8);
+            return *::new (data_ + size_++) T(std::move(value));
+        }
+        T* element = ::new (data_ + size_) T(std::forward<Args>(args)...);
+        ++size_;
+        return *element;
+    }
+
+    void PushBack(const T& value) {
+        EmplaceBack(value);
+    }
+
+    void PushBack(T&& value) {
+        EmplaceBack(std::move(value));
+    }
+
+    void PopBack() {
+        data_[--size_].~T();
+    }
+
+    void Reserve(size_t capacity) {
+        if (capacity <= capacity_) {
+            return;
+        }
+        if constexpr (kIsTriviallyRelocatable<T>) {
+            void* data = std::realloc(static_cast<void*>(data_), Bytes(capacity));
+            if (!data) {
+                throw std::bad_alloc();
+            }
+            data_ = static_cast<T*>(data);
+        } else {
+            // The old elements stay intact until all of them are in place, so that a throwing
+            // copy leaves the vector as it was.
+            T* data = Allocate(capacity);
+            size_t constructed = 0;
+            try {
+                for (; constructed < size_; ++constructed) {
+                    ::new (data + constructed) T(std::move_if_noexcept(data_[constructed]));
+                }
+            } catch (...) {
+                std::destroy_n(data, constructed);
+                std::free(data);
+                throw;
+            }
+            std::destroy_n(data_, size_);
+            std::free(data_);
+            data_ = data;
+        }
+        capacity_ = capacity;
+    }
+
+    void Clear() {
+        while (size_) {
+            PopBack();
+        }
+    }
+
+    T& operator[](size_t index) {
+        return data_[index];
+    }
+
+    const T& operator[](size_t index) const {
+        return data_[index];
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+
+    size_t Capacity() const {
+        return capacity_;
+    }
+
+    bool Empty() const {
+        return size_ == 0;
+    }
+
+    T* begin() {
+        return data_;
+    }
+
+    T* end() {
+        return data_ + size_;
+    }
+
+    const T* begin() const {
+        return data_;
+    }
+
+    const T* end() const {
+        return data_ + size_;
+    }
+
+private:
+    static size_t Bytes(size_t capacity) {
+        if (capacity > SIZE_MAX / sizeof(T)) {
+            throw std::length_error("RelocatingVector: too many elements");
+        }
+        return capacity * sizeof(T);
+    }
+
+    static T* Allocate(size_t capacity) {
+        void* data = std::malloc(Bytes(capacity));
+        if (!data) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(data);
+    }
+
+    T* data_ = nullptr;
+    size_t size_ = 0;
+    size_t capacity_ = 0;
+};
@@ -0,0 +1,16 @@
+#pragma once
+
+#if __has_include(<sys/single_threaded.h>)
+#include <sys/single_threaded.h>
+#endif
+
+// Same trick as libstdc++'s `__is_single_threaded()`: glibc keeps the flag set until the process
+// creates its first thread and never sets it back, so while it holds reference counters may be
+// updated without atomic read-modify-writes.
+inline bool IsSingleThreaded() {
+#if __has_include(<sys/single_threaded.h>)
+    return __libc_single_threaded;
+#else
+    return false;
+#endif
+}
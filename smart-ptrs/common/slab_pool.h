@@ -0,0 +1,236 @@
+#pragma once
+
+#include <common/single_threaded.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+// Fixed-size allocator for small objects of one size.
+//
+// Memory is taken from the system in `kSlabBytes` slabs aligned to their own size, so the slab of
+// a chunk is found by masking the chunk address. Each slab keeps its free chunks on a list; slabs
+// that have free chunks are linked together and `Allocate` takes from the first one. `Trim`
+// returns completely free slabs to the system. One mutex guards the pool, skipped while the
+// process is single-threaded. The pool itself is never destroyed: blocks may be released by
+// static destructors that run after it.
+//
+// In front of the mutex every thread keeps a cache of up to `kCacheChunks` free chunks, refilled
+// from the pool and flushed back to it `kBatchChunks` at a time, so threads that allocate and
+// free blocks take the lock once per batch instead of on every call. A thread returns its cache
+// when it exits; chunks sitting in caches of live threads keep their slabs from being trimmed.
+template <size_t kSize, size_t kAlign>
+class SlabPool {
+public:
+    static constexpr size_t kSlabBytes = 16 * 1024;
+
+    static SlabPool& Instance() {
+        static SlabPool* pool = new SlabPool();
+        return *pool;
+    }
+
+    static constexpr size_t kCacheChunks = 64;
+    static constexpr size_t kBatchChunks = kCacheChunks / 2;
+
+    void* Allocate() {
+        if (Cache* cache = LocalCache()) [[likely]] {
+            if (!cache->head) [[unlikely]] {
+                Refill(*cache);
+            }
+            Chunk* chunk = cache->head;
+            cache->head = chunk->next;
+            --cache->count;
+            return chunk;
+        }
+        std::unique_lock lock(mutex_, std::defer_lock);
+        if (!IsSingleThreaded()) {
+            lock.lock();
+        }
+        return Take();
+    }
+
+    void Free(void* ptr) {
+        auto chunk = static_cast<Chunk*>(ptr);
+        if (Cache* cache = LocalCache()) [[likely]] {
+            chunk->next = cache->head;
+            cache->head = chunk;
+            if (++cache->count > kCacheChunks) [[unlikely]] {
+                Flush(*cache, kBatchChunks);
+            }
+            return;
+        }
+        std::unique_lock lock(mutex_, std::defer_lock);
+        if (!IsSingleThreaded()) {
+            lock.lock();
+        }
+        Return(chunk);
+    }
+
+    // Returns the slabs without live chunks to the system, after flushing the cache of the calling
+    // thread. Returns how many were released.
+    size_t Trim() {
+        if (Cache* cache = LocalCache()) {
+            Flush(*cache, cache->count);
+        }
+        std::unique_lock lock(mutex_, std::defer_lock);
+        if (!IsSingleThreaded()) {
+            lock.lock();
+        }
+        size_t released = 0;
+        for (Slab** link = &partial_; *link;) {
+            Slab* slab = *link;
+            if (slab->used) {
+                link = &slab->next;
+                continue;
+            }
+            *link = slab->next;
+            slab->~Slab();
+            ::operator delete(slab, std::align_val_t{kSlabBytes});
+            --slabs_;
+            ++released;
+        }
+        return released;
+    }
+
+    size_t SlabCount() const {
+        return slabs_;
+    }
+
+private:
+    struct Chunk {
+        Chunk* next;
+    };
+
+    struct Slab {
+        Slab* next = nullptr;
+        Chunk* free = nullptr;
+        size_t used = 0;
+        bool partial = true;
+    };
+
+    static constexpr size_t kChunkBytes =
+        (std::max(kSize, sizeof(Chunk)) + kAlign - 1) / kAlign * kAlign;
+    static constexpr size_t kFirstChunk = (sizeof(Slab) + kAlign - 1) / kAlign * kAlign;
+    static constexpr size_t kChunksPerSlab = (kSlabBytes - kFirstChunk) / kChunkBytes;
+
+    static_assert(kChunksPerSlab > 0);
+    static_assert(kAlign <= kSlabBytes);
+
+    // Free chunks owned by one thread. Trivially destructible, so that it stays usable by
+    // destructors of other thread-locals that run after `Guard`.
+    struct Cache {
+        Chunk* head = nullptr;
+        size_t count = 0;
+        bool registered = false;
+        bool exited = false;
+    };
+
+    // Returns the cache of an exiting thread to the pool.
+    struct Guard {
+        ~Guard() {
+            Instance().Flush(*cache, cache->count);
+            cache->registered = false;
+            cache->exited = true;
+        }
+
+        Cache* cache;
+    };
+
+    SlabPool() = default;
+
+    // The cache of the calling thread, or nullptr once the thread has returned it.
+    static Cache* LocalCache() {
+        static thread_local Cache cache;
+        if (!cache.registered) [[unlikely]] {
+            if (cache.exited) {
+                return nullptr;
+            }
+            cache.registered = true;
+            static thread_local Guard guard{&cache};
+        }
+        return &cache;
+    }
+
+    void Refill(Cache& cache) {
+        std::unique_lock lock(mutex_, std::defer_lock);
+        if (!IsSingleThreaded()) {
+            lock.lock();
+        }
+        for (size_t i = 0; i < kBatchChunks; ++i) {
+            auto chunk = static_cast<Chunk*>(Take());
+            chunk->next = cache.head;
+            cache.head = chunk;
+        }
+        cache.count += kBatchChunks;
+    }
+
+    // Returns `count` chunks of the cache to the pool.
+    void Flush(Cache& cache, size_t count) {
+        if (!count) {
+            return;
+        }
+        std::unique_lock lock(mutex_, std::defer_lock);
+        if (!IsSingleThreaded()) {
+            lock.lock();
+        }
+        for (size_t i = 0; i < count; ++i) {
+            Chunk* chunk = cache.head;
+            cache.head = chunk->next;
+            Return(chunk);
+        }
+        cache.count -= count;
+    }
+
+    // A chunk from the first partial slab. Called under the lock.
+    void* Take() {
+        if (!partial_) {
+            partial_ = NewSlab();
+        }
+        Slab* slab = partial_;
+        Chunk* chunk = slab->free;
+        slab->free = chunk->next;
+        ++slab->used;
+        if (!slab->free) {
+            partial_ = slab->next;
+            slab->next = nullptr;
+            slab->partial = false;
+        }
+        return chunk;
+    }
+
+    // Called under the lock.
+    void Return(Chunk* chunk) {
+        Slab* slab = SlabOf(chunk);
+        chunk->next = slab->free;
+        slab->free = chunk;
+        --slab->used;
+        if (!slab->partial) {
+            slab->next = partial_;
+            slab->partial = true;
+            partial_ = slab;
+        }
+    }
+
+    static Slab* SlabOf(void* ptr) {
+        return reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(ptr) & ~(kSlabBytes - 1));
+    }
+
+    Slab* NewSlab() {
+        void* memory = ::operator new(kSlabBytes, std::align_val_t{kSlabBytes});
+        auto slab = new (memory) Slab();
+        char* chunks = static_cast<char*>(memory) + kFirstChunk;
+        for (size_t i = kChunksPerSlab; i--;) {
+            auto chunk = reinterpret_cast<Chunk*>(chunks + i * kChunkBytes);
+            chunk->next = slab->free;
+            slab->free = chunk;
+        }
+        ++slabs_;
+        return slab;
+    }
+
+    std::mutex mutex_;
+    Slab* partial_ = nullptr;
+    size_t slabs_ = 0;
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <shared-from-this/shared.h>
+
+#include <common/relocatable.h>
+
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+// Copy-on-write value. Copies of a `CowPtr` share one object for reading; the first mutable access
+// through a copy clones the object only if anybody else still references it, and otherwise
+// modifies it in place. References handed out by `Share` count as such, so the readers that hold
+// them never see the object change.
+//
+// A weak reference also forces a clone, since it could be locked while the object is changed.
+// The one an `EnableSharedFromThis` object keeps to itself does not count; copies of it do.
+// Immortal objects and blocks from `MakeBiasedShared` are never considered unique: the first write
+// clones them into a plain `MakeShared` block, and later writes go to the clone in place.
+// A `CowPtr` always owns an object; only a moved-from one is empty, and may just be assigned to.
+template <typename T>
+class CowPtr {
+    static_assert(!std::is_const_v<T>, "CowPtr needs a mutable object to write to");
+
+public:
+    explicit CowPtr(SharedPtr<T> ptr) : ptr_(std::move(ptr)) {
+        CheckOwned(ptr_);
+    }
+
+    CowPtr(const CowPtr&) = default;
+    CowPtr& operator=(const CowPtr&) = default;
+
+    CowPtr(CowPtr&& other) noexcept = default;
+    CowPtr& operator=(CowPtr&& other) noexcept = default;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Reads
+
+    const T& operator*() const {
+        return *ptr_;
+    }
+
+    const T* operator->() const {
+        return ptr_.Get();
+    }
+
+    const T* Get() const {
+        return ptr_.Get();
+    }
+
+    // A read-only reference to the value as of this call; later writes through this pointer clone
+    // the object and leave it alone.
+    SharedPtr<const T> Share() const {
+        return ptr_;
+    }
+
+    size_t UseCount() const {
+        return ptr_.UseCount();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Writes
+
+    // The object, cloned first if it is shared.
+    T& Mutable() {
+        CheckOwned(ptr_);
+        if (!ptr_.GetBlock()->IsUnique(SelfReferences())) {
+            ptr_ = MakeShared<T>(std::as_const(*ptr_));
+        }
+        return *ptr_;
+    }
+
+    // Replaces the object; the other holders keep the old one.
+    void Reset(SharedPtr<T> ptr) {
+        CheckOwned(ptr);
+        ptr_ = std::move(ptr);
+    }
+
+private:
+    // Weak references that the object holds to its own block.
+    uint64_t SelfReferences() const {
+        if constexpr (std::is_convertible_v<T*, EnabledSharedFromThisBase*>) {
+            return ptr_->GetWeak().GetBlock() == ptr_.GetBlock() ? 1 : 0;
+        } else {
+            return 0;
+        }
+    }
+
+    static void CheckOwned(const SharedPtr<T>& ptr) {
+        if (!ptr.GetBlock()) {
+            throw std::invalid_argument("CowPtr: no object");
+        }
+    }
+
+    SharedPtr<T> ptr_;
+};
+
+template <typename T>
+struct IsTriviallyRelocatable<CowPtr<T>> : std::true_type {};
+
+template <typename T, typename... Args>
+CowPtr<T> MakeCow(Args&&... args) {
+    return CowPtr<T>(MakeShared<T>(std::forward<Args>(args)...));
+}
@@ -0,0 +1,179 @@
+#include "cow.h"
+
+#include <shared-from-this/weak.h>
+
+#include <catch.hpp>
+
+#include "allocations_checker.h"
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Settings {
+    Settings() = default;
+
+    Settings(const Settings& other) : values(other.values) {
+        ++copies;
+    }
+
+    std::map<std::string, int> values;
+
+    static inline int copies = 0;
+};
+
+struct Document : EnableSharedFromThis<Document> {
+    Document() = default;
+
+    Document(const Document& other) : EnableSharedFromThis<Document>(other), text(other.text) {
+        ++copies;
+    }
+
+    std::string text;
+
+    static inline int copies = 0;
+};
+
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Unique objects are modified in place") {
+    Settings::copies = 0;
+    auto settings = MakeCow<Settings>();
+    settings.Mutable().values["timeout"] = 10;
+    const Settings* before = settings.Get();
+    EXPECT_ZERO_ALLOCATIONS(settings.Mutable().values["timeout"] = 20);
+    REQUIRE(settings.Get() == before);
+    REQUIRE(settings->values.at("timeout") == 20);
+    REQUIRE(Settings::copies == 0);
+}
+
+TEST_CASE("Empty pointers") {
+    REQUIRE_THROWS_AS(CowPtr<Settings>(SharedPtr<Settings>()), std::invalid_argument);
+
+    auto settings = MakeCow<Settings>();
+    REQUIRE_THROWS_AS(settings.Reset(nullptr), std::invalid_argument);
+    REQUIRE(settings.Get());
+
+    CowPtr<Settings> moved = std::move(settings);
+    REQUIRE_THROWS_AS(settings.Mutable(), std::invalid_argument);
+    settings = moved;
+    settings.Mutable().values["retries"] = 3;
+    REQUIRE(moved->values.empty());
+}
+
+TEST_CASE("Shared objects are cloned") {
+    Settings::copies = 0;
+    auto settings = MakeCow<Settings>();
+    settings.Mutable().values["timeout"] = 10;
+
+    CowPtr<Settings> copy = settings;
+    REQUIRE(copy.Get() == settings.Get());
+    copy.Mutable().values["timeout"] = 30;
+    REQUIRE(Settings::copies == 1);
+    REQUIRE(settings->values.at("timeout") == 10);
+    REQUIRE(copy->values.at("timeout") == 30);
+
+    // Both are unique now.
+    settings.Mutable().values["retries"] = 3;
+    copy.Mutable().values["retries"] = 5;
+    REQUIRE(Settings::copies == 1);
+
+    SECTION("Shared readers") {
+        SharedPtr<const Settings> reader = settings.Share();
+        settings.Mutable().values["retries"] = 4;
+        REQUIRE(Settings::copies == 2);
+        REQUIRE(reader->values.at("retries") == 3);
+        REQUIRE(settings->values.at("retries") == 4);
+    }
+
+    SECTION("Weak readers") {
+        WeakPtr<const Settings> weak = settings.Share();
+        settings.Mutable().values["retries"] = 4;
+        REQUIRE(Settings::copies == 2);
+        REQUIRE(weak.Expired());
+    }
+
+    SECTION("Immortal objects") {
+        // Immortal objects are never freed; the pointer keeps them reachable for the leak checker.
+        static auto* defaults = new SharedPtr<Settings>(MakeImmortal(MakeShared<Settings>()));
+        CowPtr<Settings> immortal(*defaults);
+        immortal.Mutable().values["retries"] = 1;
+        REQUIRE(Settings::copies == 2);
+        immortal.Mutable().values["retries"] = 2;
+        REQUIRE(Settings::copies == 2);
+    }
+
+    SECTION("Biased objects") {
+        CowPtr<Settings> biased(MakeBiasedShared<Settings>());
+        const Settings* before = biased.Get();
+        biased.Mutable().values["retries"] = 1;
+        REQUIRE(Settings::copies == 2);
+        REQUIRE(biased.Get() != before);
+        biased.Mutable().values["retries"] = 2;
+        REQUIRE(Settings::copies == 2);
+    }
+}
+
+TEST_CASE("Objects with a weak reference to themselves") {
+    Document::copies = 0;
+    CowPtr<Document> document(MakeShared<Document>());
+    const Document* before = document.Get();
+    document.Mutable().text = "draft";
+    REQUIRE(document.Get() == before);
+    REQUIRE(Document::copies == 0);
+
+    WeakPtr<Document> weak = document.Mutable().WeakFromThis();
+    document.Mutable().text = "final";
+    REQUIRE(Document::copies == 1);
+    REQUIRE(weak.Expired());
+    REQUIRE(document.Mutable().SharedFromThis().Get() == document.Get());
+    REQUIRE(Document::copies == 1);
+}
+
+TEST_CASE("Readers and a writer") {
+    constexpr int kReaders = 4;
+    constexpr int kUpdates = 1000;
+
+    auto settings = MakeCow<std::vector<int>>(100, 0);
+    std::atomic<SharedPtr<const std::vector<int>>*> published = nullptr;
+    std::vector<SharedPtr<const std::vector<int>>> versions;
+    versions.reserve(kUpdates + 1);
+    versions.push_back(settings.Share());
+    published = &versions.back();
+
+    std::atomic<bool> done = false;
+    std::atomic<int> torn = 0;
+    std::vector<std::thread> readers;
+    for (int i = 0; i < kReaders; ++i) {
+        readers.emplace_back([&] {
+            while (!done) {
+                SharedPtr<const std::vector<int>> version = *published.load();
+                if ((*version)[0] != (*version)[99]) {
+                    ++torn;
+                }
+            }
+        });
+    }
+    for (int i = 1; i <= kUpdates; ++i) {
+        std::vector<int>& values = settings.Mutable();
+        for (int& value : values) {
+            value = i;
+        }
+        versions.push_back(settings.Share());
+        published = &versions.back();
+    }
+    done = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    REQUIRE(torn == 0);
+    REQUIRE((*settings)[50] == kUpdates);
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <shared-from-this/shared.h>
+#include <shared-from-this/weak.h>
+
+#include <common/single_threaded.h>
+
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+// Hash-consing table: at most one live instance of every distinct value of `T`.
+//
+// Instances are made with `MakeShared` together with a small header whose destructor takes the
+// entry out of the table, so an instance leaves the table exactly when its last owner lets go.
+// The table keeps only `WeakPtr`s and never extends a lifetime. Equal interned values share one
+// object, so comparing them is comparing pointers.
+//
+// One mutex guards the table, skipped while the process is single-threaded. The table itself is
+// never destroyed: interned values may be released by static destructors that run after it.
+template <typename T, typename Hash = std::hash<T>, typename Equal = std::equal_to<T>>
+class InternTable {
+public:
+    static InternTable& Instance() {
+        static InternTable* table = new InternTable();
+        return *table;
+    }
+
+    // The canonical instance equal to `value`.
+    SharedPtr<const T> Intern(T&& value) {
+        size_t hash = Hash{}(value);
+        auto lock = Lock();
+        auto [first, last] = entries_.equal_range(hash);
+        for (auto it = first; it != last; ++it) {
+            // The destructor of a dying instance waits for the lock before `value` is destroyed,
+            // so it is safe to read here even if `Lock()` fails.
+            if (Equal{}(it->second.node->value, value)) {
+                if (SharedPtr<const T> existing = it->second.weak.Lock()) {
+                    return existing;
+                }
+            }
+        }
+        auto node = MakeShared<Node>(std::move(value), hash);
+        SharedPtr<const T> result(node, &node->value);
+        entries_.emplace(hash, Entry{node.Get(), result});
+        return result;
+    }
+
+    // Number of live instances.
+    size_t Size() const {
+        auto lock = Lock();
+        return entries_.size();
+    }
+
+private:
+    struct Node {
+        Node(T&& value, size_t hash) : value(std::move(value)), hash(hash) {
+        }
+
+        ~Node() {
+            InternTable::Instance().Erase(this);
+        }
+
+        T value;
+        size_t hash;
+    };
+
+    struct Entry {
+        const Node* node;
+        WeakPtr<const T> weak;
+    };
+
+    InternTable() = default;
+
+    std::unique_lock<std::mutex> Lock() const {
+        std::unique_lock lock(mutex_, std::defer_lock);
+        if (!IsSingleThreaded()) {
+            lock.lock();
+        }
+        return lock;
+    }
+
+    // Dropping the weak reference here is safe: the block is still held by the releasing thread,
+    // which frees it after the destructor returns.
+    void Erase(const Node* node) {
+        auto lock = Lock();
+        auto [first, last] = entries_.equal_range(node->hash);
+        for (auto it = first; it != last; ++it) {
+            if (it->second.node == node) {
+                entries_.erase(it);
+                return;
+            }
+        }
+    }
+
+    std::unordered_multimap<size_t, Entry> entries_;
+    mutable std::mutex mutex_;
+};
+
+// The canonical `SharedPtr` to a `T` made of `args`: the live instance equal to it if there is
+// one, a new one otherwise.
+template <typename T, typename... Args>
+SharedPtr<const T> MakeInterned(Args&&... args) {
+    return InternTable<T>::Instance().Intern(T(std::forward<Args>(args)...));
+}
@@ -0,0 +1,121 @@
+#include "interned.h"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Tag {
+    Tag(std::string name, int version) : name(std::move(name)), version(version) {
+    }
+
+    bool operator==(const Tag&) const = default;
+
+    std::string name;
+    int version;
+};
+
+// Puts every value into the same bucket.
+struct CollidingHash {
+    size_t operator()(const Tag&) const {
+        return 0;
+    }
+};
+
+}  // namespace
+
+template <>
+struct std::hash<Tag> {
+    size_t operator()(const Tag& tag) const {
+        return std::hash<std::string>{}(tag.name) ^ static_cast<size_t>(tag.version);
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Equal values share an instance") {
+    auto a = MakeInterned<std::string>("alpha");
+    auto b = MakeInterned<std::string>(std::string("alp") + "ha");
+    auto c = MakeInterned<std::string>("beta");
+    REQUIRE(a == b);
+    REQUIRE(a != c);
+    REQUIRE(*a == "alpha");
+    REQUIRE(*c == "beta");
+    REQUIRE(a.UseCount() == 2);
+    REQUIRE(InternTable<std::string>::Instance().Size() == 2);
+}
+
+TEST_CASE("The entry dies with the last owner") {
+    auto& table = InternTable<Tag>::Instance();
+    REQUIRE(table.Size() == 0);
+    {
+        auto a = MakeInterned<Tag>("x", 1);
+        auto b = MakeInterned<Tag>("x", 2);
+        REQUIRE(a != b);
+        REQUIRE(table.Size() == 2);
+        b = MakeInterned<Tag>("x", 1);
+        REQUIRE(a == b);
+        REQUIRE(table.Size() == 1);
+
+        WeakPtr<const Tag> weak = a;
+        a.Reset();
+        REQUIRE(table.Size() == 1);
+        b.Reset();
+        REQUIRE(weak.Expired());
+        REQUIRE(table.Size() == 0);
+    }
+    auto again = MakeInterned<Tag>("x", 1);
+    REQUIRE(again->version == 1);
+    REQUIRE(again.UseCount() == 1);
+}
+
+TEST_CASE("Colliding hashes") {
+    auto& table = InternTable<Tag, CollidingHash>::Instance();
+    std::vector<SharedPtr<const Tag>> tags;
+    for (int i = 0; i < 10; ++i) {
+        tags.push_back(table.Intern(Tag("tag", i)));
+    }
+    REQUIRE(table.Size() == 10);
+    for (int i = 0; i < 10; ++i) {
+        REQUIRE(table.Intern(Tag("tag", i)) == tags[i]);
+    }
+    tags.erase(tags.begin() + 3, tags.begin() + 7);
+    REQUIRE(table.Size() == 6);
+    REQUIRE(table.Intern(Tag("tag", 3)).UseCount() == 1);
+    REQUIRE(table.Intern(Tag("tag", 8)) == tags[4]);
+    tags.clear();
+    REQUIRE(table.Size() == 0);
+}
+
+TEST_CASE("Concurrent interning") {
+    constexpr int kThreads = 4;
+    constexpr int kKeys = 16;
+
+    std::atomic<int> wrong = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&, t] {
+            std::vector<SharedPtr<const int>> held(kKeys);
+            for (int i = 0; i < 5000; ++i) {
+                int key = (i * 5 + t) % kKeys;
+                auto value = MakeInterned<int>(key);
+                if (*value != key || (held[key] && held[key] != value)) {
+                    ++wrong;
+                }
+                // Drop some values so that entries die and get recreated under contention.
+                held[key] = i % 3 ? value : nullptr;
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    REQUIRE(wrong == 0);
+    REQUIRE(InternTable<int>::Instance().Size() == 0);
+}
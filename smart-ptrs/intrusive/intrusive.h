@@ -1,29 +1,57 @@
 #pragma once
 
+#include <common/deferred_release.h>
+#include <common/relocatable.h>
+#include <common/single_threaded.h>
+
+#include <atomic>
 #include <cstddef>  // for std::nullptr_t
+#include <type_traits>
 #include <utility>  // for std::exchange / std::swap
 
+// The top bit of a counter marks an immortal object: it is set once and never cleared, and the
+// count no longer changes after it is set.
+inline constexpr size_t kImmortalRefCount = ~(~size_t{0} >> 1);
+
 class SimpleCounter {
 public:
     size_t IncRef() {
+        if (count_ & kImmortalRefCount) [[unlikely]] {
+            return count_ & ~kImmortalRefCount;
+        }
         ++count_;
         return count_;
     };
 
-    size_t DecRef() {
-        --count_;
+    size_t DecRef(size_t count = 1) {
+        if (count_ & kImmortalRefCount) [[unlikely]] {
+            return count_ & ~kImmortalRefCount;
+        }
+        count_ -= count;
         return count_;
     };
 
     size_t RefCount() const {
-        return count_;
+        return count_ & ~kImmortalRefCount;
     };
 
+    void MakeImmortal() {
+        count_ |= kImmortalRefCount;
+    }
+
+    bool IsImmortal() const {
+        return count_ & kImmortalRefCount;
+    }
+
+    bool IsUnique() const {
+        return count_ == 1;
+    }
+
     SimpleCounter() = default;
 
-    SimpleCounter(const SimpleCounter& other){};
+    SimpleCounter(const SimpleCounter&){};
 
-    SimpleCounter& operator=(const SimpleCounter& other) {
+    SimpleCounter& operator=(const SimpleCounter&) {
         return *this;
     };
 
@@ -31,6 +59,64 @@ private:
     size_t count_ = 0;
 };
 
+// Thread-safe counter. Falls back to plain updates until the process starts its first thread.
+// Immortal objects are only read, so their cache line stays shared between cores.
+class AtomicCounter {
+public:
+    size_t IncRef() {
+        if (IsImmortal()) [[unlikely]] {
+            return RefCount();
+        }
+        if (IsSingleThreaded()) {
+            size_t count = count_.load(std::memory_order_relaxed) + 1;
+            count_.store(count, std::memory_order_relaxed);
+            return count;
+        }
+        return count_.fetch_add(1, std::memory_order_relaxed) + 1;
+    };
+
+    size_t DecRef(size_t count = 1) {
+        if (IsImmortal()) [[unlikely]] {
+            return RefCount();
+        }
+        if (IsSingleThreaded()) {
+            size_t value = count_.load(std::memory_order_relaxed) - count;
+            count_.store(value, std::memory_order_relaxed);
+            return value;
+        }
+        return count_.fetch_sub(count, std::memory_order_acq_rel) - count;
+    };
+
+    size_t RefCount() const {
+        return count_.load(std::memory_order_relaxed) & ~kImmortalRefCount;
+    };
+
+    void MakeImmortal() {
+        count_.fetch_or(kImmortalRefCount, std::memory_order_relaxed);
+    }
+
+    bool IsImmortal() const {
+        return count_.load(std::memory_order_relaxed) & kImmortalRefCount;
+    }
+
+    // Acquire, unlike `RefCount()`: whatever the owners that dropped their references did to the
+    // object happens before the caller's writes. Immortal objects are never unique.
+    bool IsUnique() const {
+        return count_.load(std::memory_order_acquire) == 1;
+    }
+
+    AtomicCounter() = default;
+
+    AtomicCounter(const AtomicCounter&){};
+
+    AtomicCounter& operator=(const AtomicCounter&) {
+        return *this;
+    };
+
+private:
+    std::atomic<size_t> count_ = 0;
+};
+
 struct DefaultDelete {
     template <typename T>
     static void Destroy(T* object) {
@@ -49,8 +135,14 @@ public:
     // Decrease reference counter.
     // Destroy object using Deleter when the last instance dies.
     void DecRef() {
-        counter_.DecRef();
-        if (!counter_.RefCount()) {
+        if (!counter_.DecRef()) {
+            Deleter::Destroy(static_cast<Derived*>(this));
+        }
+    };
+
+    // Drop `count` references with a single counter update.
+    void DecRef(size_t count) {
+        if (!counter_.DecRef(count)) {
             Deleter::Destroy(static_cast<Derived*>(this));
         }
     };
@@ -60,6 +152,22 @@ public:
         return counter_.RefCount();
     };
 
+    // Keep the object forever and stop counting references to it. Takes one reference that is
+    // never released, so threads racing with the call cannot bring the count to zero.
+    void MakeImmortal() {
+        counter_.IncRef();
+        counter_.MakeImmortal();
+    }
+
+    bool IsImmortal() const {
+        return counter_.IsImmortal();
+    }
+
+    // Whether the caller holds the only reference, so that the object may be modified in place.
+    bool IsUnique() const {
+        return counter_.IsUnique();
+    }
+
 private:
     Counter counter_;
 };
@@ -67,6 +175,9 @@ private:
 template <typename Derived, typename D = DefaultDelete>
 using SimpleRefCounted = RefCounted<Derived, SimpleCounter, D>;
 
+template <typename Derived, typename D = DefaultDelete>
+using AtomicRefCounted = RefCounted<Derived, AtomicCounter, D>;
+
 template <typename T>
 class IntrusivePtr {
     template <typename Y>
@@ -91,7 +202,11 @@ public:
 
     void Dec() {
         if (ptr_) {
-            ptr_->DecRef();
+            if (DeferredReleases::Active()) [[unlikely]] {
+                DeferredReleases::Push(const_cast<std::remove_cv_t<T>*>(ptr_), &ReleaseDeferred);
+            } else {
+                ptr_->DecRef();
+            }
             ptr_ = nullptr;
         }
     }
@@ -105,7 +220,7 @@ public:
     }
 
     template <typename Y>
-    IntrusivePtr(IntrusivePtr<Y>&& other) {
+    IntrusivePtr(IntrusivePtr<Y>&& other) noexcept {
         if (ptr_ != other.ptr_) {
             ptr_ = other.ptr_;
             other.ptr_ = nullptr;
@@ -119,7 +234,7 @@ public:
         }
     };
 
-    IntrusivePtr(IntrusivePtr&& other) {
+    IntrusivePtr(IntrusivePtr&& other) noexcept {
         if (ptr_ != other.ptr_) {
             ptr_ = other.ptr_;
             other.ptr_ = nullptr;
@@ -137,7 +252,7 @@ public:
         return *this;
     };
 
-    IntrusivePtr& operator=(IntrusivePtr&& other) {
+    IntrusivePtr& operator=(IntrusivePtr&& other) noexcept {
         if (ptr_ == other.ptr_) {
             return *this;
         }
@@ -163,7 +278,7 @@ public:
         Inc();
     };
 
-    void Swap(IntrusivePtr& other) {
+    void Swap(IntrusivePtr& other) noexcept {
         std::swap(ptr_, other.ptr_);
     };
 
@@ -187,15 +302,52 @@ public:
         return ptr_->RefCount();
     };
 
+    // Whether this is the only reference. Orders the writes that follow after everything the
+    // other owners did before they let go, which `UseCount() == 1` does not.
+    bool IsUnique() const {
+        if (!ptr_) {
+            return false;
+        }
+        if constexpr (requires { ptr_->IsUnique(); }) {
+            return ptr_->IsUnique();
+        } else {
+            return ptr_->RefCount() == 1;
+        }
+    };
+
     explicit operator bool() const {
         return (ptr_ != nullptr);
     };
 
 private:
+    // Types with their own counter may only have the single-step `DecRef()`.
+    static void ReleaseDeferred(void* object, size_t count) {
+        T* ptr = static_cast<T*>(object);
+        if constexpr (requires { ptr->DecRef(count); }) {
+            ptr->DecRef(count);
+        } else {
+            while (count--) {
+                ptr->DecRef();
+            }
+        }
+    }
+
     T* ptr_ = nullptr;
 };
 
+template <typename T>
+struct IsTriviallyRelocatable<IntrusivePtr<T>> : std::true_type {};
+
 template <typename T, typename... Args>
 IntrusivePtr<T> MakeIntrusive(Args&&... args) {
     return std::move(IntrusivePtr<T>(new T(std::forward<Args>(args)...)));
 }
+
+// Makes the object immortal, see `RefCounted::MakeImmortal`.
+template <typename T>
+IntrusivePtr<T> MakeImmortal(IntrusivePtr<T> ptr) {
+    if (ptr) {
+        ptr->MakeImmortal();
+    }
+    return ptr;
+}
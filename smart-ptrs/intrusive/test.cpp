@@ -4,7 +4,11 @@
 
 #include "allocations_checker.h"
 
+#include <common/relocating_vector.h>
+
 #include <string>
+#include <thread>
+#include <vector>
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -386,3 +390,121 @@ TEST_CASE("Object pool") {
         REQUIRE(strs.NumInUse() == 1);
     }
 }
+
+struct SharedCountedString : AtomicRefCounted<SharedCountedString>,
+                             ObjectCounters<SharedCountedString>,
+                             std::string {
+    using std::string::basic_string;
+};
+
+TEST_CASE("Atomic counter") {
+    constexpr int kThreads = 8;
+    constexpr int kIterations = 10000;
+
+    {
+        auto str = MakeIntrusive<SharedCountedString>("shared");
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kThreads; ++i) {
+            threads.emplace_back([str] {
+                for (int j = 0; j < kIterations; ++j) {
+                    IntrusivePtr<SharedCountedString> copy = str;
+                    copy.Reset();
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(str.UseCount() == 1);
+        REQUIRE(SharedCountedString::NumAlive() == 1);
+    }
+    REQUIRE(SharedCountedString::NumAlive() == 0);
+}
+
+TEST_CASE("Deferred releases") {
+    CountedString::ResetCounters();
+    {
+        DeferredReleaseScope scope;
+        auto str = MakeIntrusive<CountedString>("deferred");
+        for (int i = 0; i < 100; ++i) {
+            IntrusivePtr<CountedString> copy = str;
+        }
+        REQUIRE(str.UseCount() == 101);
+        str.Reset();
+        REQUIRE(CountedString::NumAlive() == 1);
+    }
+    REQUIRE(CountedString::NumAlive() == 0);
+}
+
+TEST_CASE("Relocation") {
+    static_assert(std::is_nothrow_move_constructible_v<IntrusivePtr<MyInt>>);
+    static_assert(std::is_nothrow_move_assignable_v<IntrusivePtr<MyInt>>);
+    static_assert(kIsTriviallyRelocatable<IntrusivePtr<MyInt>>);
+
+    auto ptr = MakeIntrusive<MyInt>(7);
+    {
+        RelocatingVector<IntrusivePtr<MyInt>> ptrs;
+        for (int i = 0; i < 1000; ++i) {
+            ptrs.PushBack(ptr);
+        }
+        REQUIRE(ptr.UseCount() == 1001);
+    }
+    REQUIRE(ptr.UseCount() == 1);
+}
+
+TEST_CASE("Immortal objects") {
+    SECTION("Simple counter") {
+        MyInt value(5);
+        {
+            auto ptr = MakeImmortal(IntrusivePtr<MyInt>(&value));
+            REQUIRE(value.IsImmortal());
+            REQUIRE(ptr.UseCount() == 2);
+            IntrusivePtr<MyInt> copy = ptr;
+            REQUIRE(ptr.UseCount() == 2);
+        }
+        // Nobody deleted the object on the stack.
+        REQUIRE(value.RefCount() == 2);
+    }
+
+    SECTION("Atomic counter") {
+        constexpr int kThreads = 4;
+        SharedCountedString str("immortal");
+        auto ptr = MakeImmortal(IntrusivePtr<SharedCountedString>(&str));
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kThreads; ++i) {
+            threads.emplace_back([ptr] {
+                for (int j = 0; j < 1000; ++j) {
+                    IntrusivePtr<SharedCountedString> copy = ptr;
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(ptr.UseCount() == 2);
+        ptr.Reset();
+        REQUIRE(str.RefCount() == 2);
+    }
+}
+
+TEST_CASE("Uniqueness") {
+    IntrusivePtr<MyInt> empty;
+    REQUIRE_FALSE(empty.IsUnique());
+
+    IntrusivePtr<MyInt> simple(new MyInt(1));
+    REQUIRE(simple.IsUnique());
+    IntrusivePtr<MyInt> copy = simple;
+    REQUIRE_FALSE(simple.IsUnique());
+    copy.Reset();
+    REQUIRE(simple.IsUnique());
+
+    IntrusivePtr<SharedCountedString> shared(new SharedCountedString("shared"));
+    REQUIRE(shared.IsUnique());
+    std::thread([copy = shared]() mutable { copy.Reset(); }).join();
+    REQUIRE(shared.IsUnique());
+
+    SharedCountedString str("immortal");
+    IntrusivePtr<SharedCountedString> immortal(&str);
+    MakeImmortal(immortal);
+    REQUIRE_FALSE(immortal.IsUnique());
+}
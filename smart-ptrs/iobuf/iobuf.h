@@ -0,0 +1,375 @@
+#pragma once
+
+#include <shared-from-this/shared.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <sys/uio.h>
+
+// Chain of byte segments for passing framed messages between pipeline stages without copying.
+//
+// Every segment references a backing buffer made by `MakeSharedForOverwrite<std::byte[]>`, so the
+// buffer and its reference counts share one allocation, and views a part of it. The bytes before
+// the view are the headroom, the bytes after it the tailroom: a stage adds its header or trailer in
+// place when the buffer is not shared with anybody else, and links in a fresh segment when it is.
+// Segments form a circular list, so whole chains are appended and prepended in O(1). `Clone`
+// shares all buffers, `Coalesce` copies the chain into one buffer when a stage needs contiguous
+// bytes, and `FillIov` exports the segments for scatter/gather I/O.
+class IOBuf {
+    struct Segment;
+
+public:
+    // Size of segments allocated by `Prepend` and `Append` when the room runs out.
+    static constexpr size_t kMinSegmentBytes = 256;
+
+    IOBuf() = default;
+
+    IOBuf(const IOBuf&) = delete;
+    IOBuf& operator=(const IOBuf&) = delete;
+
+    IOBuf(IOBuf&& other) noexcept
+        : head_(std::exchange(other.head_, nullptr)), size_(std::exchange(other.size_, 0)) {
+    }
+
+    IOBuf& operator=(IOBuf&& other) noexcept {
+        if (this != &other) {
+            Clear();
+            head_ = std::exchange(other.head_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+        }
+        return *this;
+    }
+
+    ~IOBuf() {
+        Clear();
+    }
+
+    // One empty segment of `capacity` bytes, `headroom` of them in front of the data.
+    static IOBuf Create(size_t capacity, size_t headroom = 0) {
+        if (headroom > capacity) {
+            throw std::invalid_argument("IOBuf: headroom exceeds capacity");
+        }
+        IOBuf result;
+        result.Link(NewSegment(capacity, headroom), false);
+        return result;
+    }
+
+    // A copy of `size` bytes at `data` with room around them.
+    static IOBuf CopyBuffer(const void* data, size_t size, size_t headroom = 0,
+                            size_t tailroom = 0) {
+        IOBuf result = Create(headroom + size + tailroom, headroom);
+        std::memcpy(result.Append(size), data, size);
+        return result;
+    }
+
+    // Wraps `length` bytes at the start of a buffer of `capacity` bytes without copying.
+    static IOBuf Wrap(SharedPtr<std::byte[]> buffer, size_t capacity, size_t length) {
+        if (length > capacity) {
+            throw std::invalid_argument("IOBuf: length exceeds capacity");
+        }
+        IOBuf result;
+        result.Link(new Segment{std::move(buffer), capacity, 0, length}, false);
+        return result;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Chains
+
+    // Moves the segments of `other` to the end of this chain.
+    void AppendChain(IOBuf&& other) {
+        if (!other.head_) {
+            return;
+        }
+        if (!head_) {
+            *this = std::move(other);
+            return;
+        }
+        Segment* tail = head_->prev;
+        Segment* other_tail = other.head_->prev;
+        tail->next = other.head_;
+        other.head_->prev = tail;
+        other_tail->next = head_;
+        head_->prev = other_tail;
+        size_ += std::exchange(other.size_, 0);
+        other.head_ = nullptr;
+    }
+
+    // Moves the segments of `other` to the front of this chain.
+    void PrependChain(IOBuf&& other) {
+        Segment* other_head = other.head_;
+        AppendChain(std::move(other));
+        if (other_head) {
+            head_ = other_head;
+        }
+    }
+
+    // Detaches the first `size` bytes as a separate chain. A segment cut in two is shared by both.
+    IOBuf SplitFront(size_t size) {
+        CheckSize(size);
+        IOBuf front;
+        while (size) {
+            Segment* segment = head_;
+            if (segment->length <= size) {
+                size -= segment->length;
+                size_ -= segment->length;
+                Unlink(segment);
+                front.Link(segment, false);
+            } else {
+                front.Link(new Segment{segment->buffer, segment->capacity, segment->offset, size},
+                           false);
+                segment->offset += size;
+                segment->length -= size;
+                size_ -= size;
+                size = 0;
+            }
+        }
+        return front;
+    }
+
+    // A chain with the same bytes that shares every buffer with this one.
+    IOBuf Clone() const {
+        IOBuf result;
+        ForEachSegment([&](const Segment* segment) {
+            result.Link(new Segment{segment->buffer, segment->capacity, segment->offset,
+                                    segment->length},
+                        false);
+        });
+        return result;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Data
+
+    // Makes room for `size` bytes in front of the data and returns them, uninitialized.
+    std::byte* Prepend(size_t size) {
+        if (!head_ || !head_->IsUnique() || head_->offset < size) {
+            size_t capacity = std::max(size, kMinSegmentBytes);
+            Link(NewSegment(capacity, capacity), true);
+        }
+        head_->offset -= size;
+        head_->length += size;
+        size_ += size;
+        return head_->Data();
+    }
+
+    // Makes room for `size` bytes after the data and returns them, uninitialized.
+    std::byte* Append(size_t size) {
+        Segment* tail = head_ ? head_->prev : nullptr;
+        if (!tail || !tail->IsUnique() || tail->Tailroom() < size) {
+            tail = NewSegment(std::max(size, kMinSegmentBytes), 0);
+            Link(tail, false);
+        }
+        std::byte* data = tail->Data() + tail->length;
+        tail->length += size;
+        size_ += size;
+        return data;
+    }
+
+    // Drops `size` bytes from the front; segments left empty are released.
+    void TrimStart(size_t size) {
+        CheckSize(size);
+        size_ -= size;
+        while (size) {
+            Segment* segment = head_;
+            size_t step = std::min(size, segment->length);
+            segment->offset += step;
+            segment->length -= step;
+            size -= step;
+            if (!segment->length) {
+                Unlink(segment);
+                delete segment;
+            }
+        }
+    }
+
+    // Drops `size` bytes from the back; segments left empty are released.
+    void TrimEnd(size_t size) {
+        CheckSize(size);
+        size_ -= size;
+        while (size) {
+            Segment* segment = head_->prev;
+            size_t step = std::min(size, segment->length);
+            segment->length -= step;
+            size -= step;
+            if (!segment->length) {
+                Unlink(segment);
+                delete segment;
+            }
+        }
+    }
+
+    // Copies the chain into a single buffer, keeping the headroom of the first segment and the
+    // tailroom of the last one, and returns the bytes. Does nothing for a single segment.
+    std::span<std::byte> Coalesce() {
+        if (!head_) {
+            return {};
+        }
+        if (head_->next != head_) {
+            size_t headroom = head_->offset;
+            Segment* segment = NewSegment(headroom + size_ + head_->prev->Tailroom(), headroom);
+            segment->length = size_;
+            std::byte* out = segment->Data();
+            ForEachSegment([&](const Segment* part) {
+                std::memcpy(out, part->Data(), part->length);
+                out += part->length;
+            });
+            Clear();
+            Link(segment, false);
+        }
+        return {head_->Data(), head_->length};
+    }
+
+    // Fills up to `count` entries of `iov` with the segments and returns how many were used.
+    size_t FillIov(iovec* iov, size_t count) const {
+        size_t used = 0;
+        ForEachSegment([&](const Segment* segment) {
+            if (used < count && segment->length) {
+                iov[used++] = {segment->Data(), segment->length};
+            }
+        });
+        return used;
+    }
+
+    std::vector<iovec> GetIov() const {
+        std::vector<iovec> iov(SegmentCount());
+        iov.resize(FillIov(iov.data(), iov.size()));
+        return iov;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    // Total number of bytes in the chain.
+    size_t Size() const {
+        return size_;
+    }
+
+    bool Empty() const {
+        return size_ == 0;
+    }
+
+    size_t SegmentCount() const {
+        size_t count = 0;
+        ForEachSegment([&](const Segment*) { ++count; });
+        return count;
+    }
+
+    size_t Headroom() const {
+        return head_ ? head_->offset : 0;
+    }
+
+    size_t Tailroom() const {
+        return head_ ? head_->prev->Tailroom() : 0;
+    }
+
+    // Bytes of the `index`-th segment.
+    std::span<std::byte> SegmentData(size_t index) const {
+        const Segment* segment = head_;
+        while (index--) {
+            segment = segment->next;
+        }
+        return {segment->Data(), segment->length};
+    }
+
+    // Copies the bytes to `out`, which must have room for `Size()` of them.
+    void CopyTo(void* out) const {
+        auto dest = static_cast<std::byte*>(out);
+        ForEachSegment([&](const Segment* segment) {
+            std::memcpy(dest, segment->Data(), segment->length);
+            dest += segment->length;
+        });
+    }
+
+    void Clear() {
+        while (head_) {
+            Segment* segment = head_;
+            Unlink(segment);
+            delete segment;
+        }
+        size_ = 0;
+    }
+
+private:
+    struct Segment {
+        SharedPtr<std::byte[]> buffer;
+        size_t capacity;
+        size_t offset;
+        size_t length;
+        Segment* prev = nullptr;
+        Segment* next = nullptr;
+
+        std::byte* Data() const {
+            return buffer.Get() + offset;
+        }
+
+        size_t Tailroom() const {
+            return capacity - offset - length;
+        }
+
+        // Only a buffer nobody else references, not even weakly, may be written around the view.
+        // The acquire load orders the reads of threads that dropped their references before our
+        // writes.
+        bool IsUnique() const {
+            return buffer.GetBlock() && buffer.GetBlock()->IsUnique();
+        }
+    };
+
+    static Segment* NewSegment(size_t capacity, size_t offset) {
+        return new Segment{MakeSharedForOverwrite<std::byte[]>(capacity), capacity, offset, 0};
+    }
+
+    void CheckSize(size_t size) const {
+        if (size > size_) {
+            throw std::out_of_range("IOBuf: not enough data");
+        }
+    }
+
+    template <class F>
+    void ForEachSegment(F&& f) const {
+        if (const Segment* segment = head_) {
+            do {
+                f(segment);
+                segment = segment->next;
+            } while (segment != head_);
+        }
+    }
+
+    // Inserts `segment` at the front or the back and counts its bytes.
+    void Link(Segment* segment, bool front) {
+        if (!head_) {
+            segment->prev = segment->next = segment;
+            head_ = segment;
+        } else {
+            segment->next = head_;
+            segment->prev = head_->prev;
+            head_->prev->next = segment;
+            head_->prev = segment;
+            if (front) {
+                head_ = segment;
+            }
+        }
+        size_ += segment->length;
+    }
+
+    // Removes `segment` from the list; the byte count is left to the caller.
+    void Unlink(Segment* segment) {
+        if (segment->next == segment) {
+            head_ = nullptr;
+        } else {
+            segment->prev->next = segment->next;
+            segment->next->prev = segment->prev;
+            if (head_ == segment) {
+                head_ = segment->next;
+            }
+        }
+    }
+
+    Segment* head_ = nullptr;
+    size_t size_ = 0;
+};
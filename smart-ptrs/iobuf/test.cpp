@@ -0,0 +1,156 @@
+#include "iobuf.h"
+
+#include <catch.hpp>
+
+#include "allocations_checker.h"
+
+#include <shared-from-this/weak.h>
+
+#include <string>
+#include <string_view>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+IOBuf FromString(std::string_view str, size_t headroom = 0, size_t tailroom = 0) {
+    return IOBuf::CopyBuffer(str.data(), str.size(), headroom, tailroom);
+}
+
+std::string ToString(const IOBuf& buf) {
+    std::string result(buf.Size(), '\0');
+    buf.CopyTo(result.data());
+    return result;
+}
+
+void Write(std::byte* out, std::string_view str) {
+    std::memcpy(out, str.data(), str.size());
+}
+
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Empty") {
+    IOBuf buf;
+    REQUIRE(buf.Empty());
+    REQUIRE(buf.SegmentCount() == 0);
+    REQUIRE(buf.Coalesce().empty());
+    REQUIRE(buf.GetIov().empty());
+    REQUIRE(buf.Clone().Empty());
+    REQUIRE_THROWS_AS(buf.TrimStart(1), std::out_of_range);
+}
+
+TEST_CASE("Headroom and tailroom") {
+    IOBuf buf = FromString("payload", 8, 4);
+    REQUIRE(buf.Headroom() == 8);
+    REQUIRE(buf.Tailroom() == 4);
+
+    SECTION("In place") {
+        EXPECT_ZERO_ALLOCATIONS(Write(buf.Prepend(4), "hdr:"); Write(buf.Append(4), ":crc"));
+        REQUIRE(buf.SegmentCount() == 1);
+        REQUIRE(buf.Headroom() == 4);
+        REQUIRE(buf.Tailroom() == 0);
+        REQUIRE(ToString(buf) == "hdr:payload:crc");
+    }
+
+    SECTION("Out of room") {
+        Write(buf.Prepend(10), "long head ");
+        Write(buf.Append(5), " tail");
+        REQUIRE(buf.SegmentCount() == 3);
+        REQUIRE(ToString(buf) == "long head payload tail");
+    }
+
+    SECTION("Shared buffers are not written") {
+        IOBuf clone = buf.Clone();
+        Write(buf.Prepend(2), "a:");
+        Write(clone.Prepend(2), "b:");
+        REQUIRE(buf.SegmentCount() == 2);
+        REQUIRE(ToString(buf) == "a:payload");
+        REQUIRE(ToString(clone) == "b:payload");
+    }
+
+    SECTION("Weakly referenced buffers are not written") {
+        auto buffer = MakeSharedForOverwrite<std::byte[]>(16);
+        Write(buffer.Get(), "data");
+        WeakPtr<std::byte[]> weak = buffer;
+        IOBuf wrapped = IOBuf::Wrap(std::move(buffer), 16, 4);
+        Write(wrapped.Append(4), "more");
+        REQUIRE(wrapped.SegmentCount() == 2);
+        REQUIRE(ToString(wrapped) == "datamore");
+    }
+}
+
+TEST_CASE("Chains") {
+    IOBuf a = FromString("one ");
+    IOBuf b = FromString("two ");
+    IOBuf c = FromString("three");
+
+    EXPECT_ZERO_ALLOCATIONS(a.AppendChain(std::move(c)); a.PrependChain(std::move(b)));
+    REQUIRE(b.Empty());
+    REQUIRE(c.Empty());
+    REQUIRE(a.SegmentCount() == 3);
+    REQUIRE(a.Size() == 13);
+    REQUIRE(ToString(a) == "two one three");
+
+    std::vector<iovec> iov = a.GetIov();
+    REQUIRE(iov.size() == 3);
+    REQUIRE(std::string(static_cast<char*>(iov[1].iov_base), iov[1].iov_len) == "one ");
+    iovec first;
+    REQUIRE(a.FillIov(&first, 1) == 1);
+    REQUIRE(first.iov_len == 4);
+
+    SECTION("Trim") {
+        a.TrimStart(6);
+        REQUIRE(a.SegmentCount() == 2);
+        a.TrimEnd(4);
+        REQUIRE(ToString(a) == "e t");
+        a.TrimEnd(2);
+        REQUIRE(a.SegmentCount() == 1);
+        REQUIRE(ToString(a) == "e");
+        a.TrimEnd(1);
+        REQUIRE(a.Empty());
+        REQUIRE(a.SegmentCount() == 0);
+    }
+
+    SECTION("Split") {
+        IOBuf front = a.SplitFront(6);
+        REQUIRE(ToString(front) == "two on");
+        REQUIRE(ToString(a) == "e three");
+        REQUIRE(front.SegmentData(1).data() + 2 == a.SegmentData(0).data());
+        REQUIRE(a.SplitFront(7).Size() == 7);
+        REQUIRE(a.Empty());
+    }
+
+    SECTION("Coalesce") {
+        a.PrependChain(IOBuf::Create(16, 16));
+        a.AppendChain(IOBuf::Create(8));
+        auto bytes = a.Coalesce();
+        REQUIRE(a.SegmentCount() == 1);
+        REQUIRE(bytes.size() == 13);
+        REQUIRE(a.Headroom() == 16);
+        REQUIRE(a.Tailroom() == 8);
+        REQUIRE(ToString(a) == "two one three");
+        EXPECT_ZERO_ALLOCATIONS(a.Coalesce());
+    }
+}
+
+TEST_CASE("Pipeline") {
+    // Every stage frames the message of the previous one without copying it.
+    IOBuf message = FromString("body", 64);
+    for (int stage = 0; stage < 5; ++stage) {
+        Write(message.Prepend(2), "[" + std::to_string(stage));
+        Write(message.Append(1), "]");
+    }
+    REQUIRE(ToString(message) == "[4[3[2[1[0body]]]]]");
+    REQUIRE(message.SegmentCount() == 2);
+
+    auto buffer = MakeSharedForOverwrite<std::byte[]>(4);
+    Write(buffer.Get(), "wrap");
+    IOBuf wrapped = IOBuf::Wrap(buffer, 4, 4);
+    REQUIRE(buffer.UseCount() == 2);
+    message.AppendChain(std::move(wrapped));
+    REQUIRE(ToString(message) == "[4[3[2[1[0body]]]]]wrap");
+    message.Clear();
+    REQUIRE(buffer.UseCount() == 1);
+}
@@ -0,0 +1,352 @@
+#pragma once
+
+#include <intrusive/intrusive.h>
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+template <typename K, typename V, typename Hash>
+class TransientMap;
+
+// Node of a `PersistentMap`. The bits of `datamap` mark the slots that hold an entry, the bits of
+// `nodemap` the slots that hold a subtree; both arrays are in slot order. Below the last level
+// of hash bits a node only holds colliding entries, in no particular order.
+template <typename K, typename V>
+struct MapNode : AtomicRefCounted<MapNode<K, V>> {
+    uint32_t datamap = 0;
+    uint32_t nodemap = 0;
+    std::vector<std::pair<K, V>> entries;
+    std::vector<IntrusivePtr<MapNode>> children;
+};
+
+// Immutable hash map as a hash array mapped trie: each level consumes five bits of the key's hash
+// and holds up to 32 entries and subtrees, so lookups take O(log32 n) steps.
+//
+// Snapshots, updates and transients work like in `PersistentVector`: copies share the whole trie,
+// an update copies the nodes on the path to the key, and updates of a dying map or of a
+// `TransientMap` change the nodes that are `IsUnique()` in place. The trie is kept canonical: a
+// subtree left with a single entry is folded into its parent.
+template <typename K, typename V, typename Hash = std::hash<K>>
+class PersistentMap {
+    using Node = MapNode<K, V>;
+    using NodePtr = IntrusivePtr<Node>;
+
+    friend class TransientMap<K, V, Hash>;
+
+public:
+    PersistentMap() = default;
+
+    PersistentMap(const PersistentMap&) = default;
+    PersistentMap& operator=(const PersistentMap&) = default;
+
+    PersistentMap(PersistentMap&& other) noexcept
+        : root_(std::move(other.root_)), size_(std::exchange(other.size_, 0)) {
+    }
+
+    PersistentMap& operator=(PersistentMap&& other) noexcept {
+        root_ = std::move(other.root_);
+        size_ = std::exchange(other.size_, 0);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Updates
+
+    // Inserts the key or replaces its value.
+    PersistentMap Set(K key, V value) const& {
+        return PersistentMap(*this).Set(std::move(key), std::move(value));
+    }
+
+    PersistentMap Set(K key, V value) && {
+        SetInPlace(std::move(key), std::move(value));
+        return std::move(*this);
+    }
+
+    PersistentMap Erase(const K& key) const& {
+        if (!Contains(key)) {
+            return *this;
+        }
+        return PersistentMap(*this).Erase(key);
+    }
+
+    PersistentMap Erase(const K& key) && {
+        EraseInPlace(key);
+        return std::move(*this);
+    }
+
+    // A mutable copy for a batch of updates.
+    TransientMap<K, V, Hash> Transient() const {
+        return TransientMap<K, V, Hash>(*this);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    // The value of `key`, or nullptr.
+    const V* Find(const K& key) const {
+        uint64_t hash = HashOf(key);
+        const Node* node = root_.Get();
+        for (size_t shift = 0; node; shift += kBits) {
+            if (shift >= kHashBits) {
+                for (const auto& entry : node->entries) {
+                    if (entry.first == key) {
+                        return &entry.second;
+                    }
+                }
+                return nullptr;
+            }
+            uint32_t bit = BitOf(hash, shift);
+            if (node->datamap & bit) {
+                const auto& entry = node->entries[IndexOf(node->datamap, bit)];
+                return entry.first == key ? &entry.second : nullptr;
+            }
+            if (!(node->nodemap & bit)) {
+                return nullptr;
+            }
+            node = node->children[IndexOf(node->nodemap, bit)].Get();
+        }
+        return nullptr;
+    }
+
+    const V& At(const K& key) const {
+        if (const V* value = Find(key)) {
+            return *value;
+        }
+        throw std::out_of_range("PersistentMap: no such key");
+    }
+
+    bool Contains(const K& key) const {
+        return Find(key) != nullptr;
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+
+    bool Empty() const {
+        return size_ == 0;
+    }
+
+    // Calls `f(key, value)` for every entry, in no particular order.
+    template <class F>
+    void ForEach(F&& f) const {
+        ForEachIn(root_.Get(), f);
+    }
+
+private:
+    static constexpr size_t kBits = 5;
+    static constexpr size_t kHashBits = 64;
+
+    // `std::hash` of integers is the identity; mixing spreads the keys over all levels.
+    static uint64_t HashOf(const K& key) {
+        uint64_t hash = Hash{}(key);
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+        hash *= 0xc4ceb9fe1a85ec53ULL;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
+    static uint32_t BitOf(uint64_t hash, size_t shift) {
+        return uint32_t{1} << ((hash >> shift) & 31);
+    }
+
+    static size_t IndexOf(uint32_t map, uint32_t bit) {
+        return std::popcount(map & (bit - 1));
+    }
+
+    // The node in `slot`, copied first unless `slot` is its only reference.
+    static Node* Unique(NodePtr& slot) {
+        if (!slot.IsUnique()) {
+            slot = NodePtr(new Node(*slot));
+        }
+        return slot.Get();
+    }
+
+    void SetInPlace(K&& key, V&& value) {
+        if (!root_) {
+            root_ = NodePtr(new Node());
+        }
+        if (Set(root_, 0, HashOf(key), std::move(key), std::move(value))) {
+            ++size_;
+        }
+    }
+
+    void EraseInPlace(const K& key) {
+        if (!root_ || !Contains(key)) {
+            return;
+        }
+        Erase(root_, 0, HashOf(key), key);
+        --size_;
+        if (root_->entries.empty() && root_->children.empty()) {
+            root_.Reset();
+        }
+    }
+
+    // Returns whether the key was added.
+    static bool Set(NodePtr& slot, size_t shift, uint64_t hash, K&& key, V&& value) {
+        Node* node = Unique(slot);
+        if (shift >= kHashBits) {
+            for (auto& entry : node->entries) {
+                if (entry.first == key) {
+                    entry.second = std::move(value);
+                    return false;
+                }
+            }
+            node->entries.emplace_back(std::move(key), std::move(value));
+            return true;
+        }
+        uint32_t bit = BitOf(hash, shift);
+        if (node->datamap & bit) {
+            size_t index = IndexOf(node->datamap, bit);
+            auto& entry = node->entries[index];
+            if (entry.first == key) {
+                entry.second = std::move(value);
+                return false;
+            }
+            // Two keys share the slot: both move one level down. The subtree is built before the
+            // entry leaves this node, so that a failed allocation loses nothing.
+            uint64_t other_hash = HashOf(entry.first);
+            NodePtr child = MakePair(shift + kBits, other_hash, {std::move(key), std::move(value)},
+                                     hash);
+            node->children.reserve(node->children.size() + 1);
+            Place(child, shift + kBits, std::move(entry), other_hash);
+            node->entries.erase(node->entries.begin() + index);
+            node->datamap ^= bit;
+            node->nodemap |= bit;
+            node->children.insert(node->children.begin() + IndexOf(node->nodemap, bit),
+                                  std::move(child));
+            return true;
+        }
+        if (node->nodemap & bit) {
+            return Set(node->children[IndexOf(node->nodemap, bit)], shift + kBits, hash,
+                       std::move(key), std::move(value));
+        }
+        node->datamap |= bit;
+        node->entries.emplace(node->entries.begin() + IndexOf(node->datamap, bit), std::move(key),
+                              std::move(value));
+        return true;
+    }
+
+    // A subtree holding `entry`, with room reserved for one more entry with `other_hash`, so that
+    // `Place` does not allocate.
+    static NodePtr MakePair(size_t shift, uint64_t other_hash, std::pair<K, V>&& entry,
+                            uint64_t hash) {
+        NodePtr node(new Node());
+        if (shift < kHashBits && BitOf(hash, shift) == BitOf(other_hash, shift)) {
+            node->nodemap = BitOf(hash, shift);
+            node->children.push_back(MakePair(shift + kBits, other_hash, std::move(entry), hash));
+            return node;
+        }
+        node->entries.reserve(2);
+        if (shift < kHashBits) {
+            node->datamap = BitOf(hash, shift);
+        }
+        node->entries.push_back(std::move(entry));
+        return node;
+    }
+
+    // Adds `entry` to a subtree made by `MakePair`, into the room reserved for it.
+    static void Place(const NodePtr& subtree, size_t shift, std::pair<K, V>&& entry,
+                      uint64_t hash) {
+        Node* node = subtree.Get();
+        while (shift < kHashBits && (node->nodemap & BitOf(hash, shift))) {
+            node = node->children.front().Get();
+            shift += kBits;
+        }
+        if (shift >= kHashBits) {
+            node->entries.push_back(std::move(entry));
+            return;
+        }
+        uint32_t bit = BitOf(hash, shift);
+        node->datamap |= bit;
+        node->entries.insert(node->entries.begin() + IndexOf(node->datamap, bit),
+                             std::move(entry));
+    }
+
+    // Erases a key that is known to be present.
+    static void Erase(NodePtr& slot, size_t shift, uint64_t hash, const K& key) {
+        Node* node = Unique(slot);
+        if (shift >= kHashBits) {
+            for (size_t i = 0; i < node->entries.size(); ++i) {
+                if (node->entries[i].first == key) {
+                    node->entries.erase(node->entries.begin() + i);
+                    return;
+                }
+            }
+            return;
+        }
+        uint32_t bit = BitOf(hash, shift);
+        if (node->datamap & bit) {
+            node->entries.erase(node->entries.begin() + IndexOf(node->datamap, bit));
+            node->datamap ^= bit;
+            return;
+        }
+        size_t index = IndexOf(node->nodemap, bit);
+        NodePtr& child = node->children[index];
+        Erase(child, shift + kBits, hash, key);
+        if (!child->children.empty() || child->entries.size() != 1) {
+            return;
+        }
+        // Fold a subtree with a single entry into this node.
+        std::pair<K, V> entry = std::move(child->entries.front());
+        node->children.erase(node->children.begin() + index);
+        node->nodemap ^= bit;
+        node->datamap |= bit;
+        node->entries.insert(node->entries.begin() + IndexOf(node->datamap, bit), std::move(entry));
+    }
+
+    template <class F>
+    static void ForEachIn(const Node* node, F& f) {
+        if (!node) {
+            return;
+        }
+        for (const auto& [key, value] : node->entries) {
+            f(key, value);
+        }
+        for (const NodePtr& child : node->children) {
+            ForEachIn(child.Get(), f);
+        }
+    }
+
+    NodePtr root_;
+    size_t size_ = 0;
+};
+
+// Mutable handle for a batch of updates to a `PersistentMap`, see `TransientVector`.
+template <typename K, typename V, typename Hash = std::hash<K>>
+class TransientMap {
+public:
+    explicit TransientMap(PersistentMap<K, V, Hash> map) : map_(std::move(map)) {
+    }
+
+    void Set(K key, V value) {
+        map_.SetInPlace(std::move(key), std::move(value));
+    }
+
+    void Erase(const K& key) {
+        map_.EraseInPlace(key);
+    }
+
+    const V* Find(const K& key) const {
+        return map_.Find(key);
+    }
+
+    size_t Size() const {
+        return map_.Size();
+    }
+
+    // The result of the batch. The transient is left empty.
+    PersistentMap<K, V, Hash> Persistent() {
+        return std::move(map_);
+    }
+
+private:
+    PersistentMap<K, V, Hash> map_;
+};
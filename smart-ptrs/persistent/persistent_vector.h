@@ -0,0 +1,410 @@
+#pragma once
+
+#include <intrusive/intrusive.h>
+
+#include <cstddef>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+template <typename T>
+class TransientVector;
+
+template <typename T>
+struct VectorNode;
+
+// Frees a trie node as its real type.
+struct VectorNodeDelete {
+    template <typename T>
+    static void Destroy(VectorNode<T>* node);
+};
+
+template <typename T>
+struct VectorNode : AtomicRefCounted<VectorNode<T>, VectorNodeDelete> {
+    static constexpr size_t kBits = 5;
+    static constexpr size_t kWidth = size_t{1} << kBits;
+    static constexpr size_t kMask = kWidth - 1;
+
+    explicit VectorNode(bool is_leaf) : is_leaf(is_leaf) {
+    }
+
+    const bool is_leaf;
+};
+
+template <typename T>
+struct VectorBranch : VectorNode<T> {
+    VectorBranch() : VectorNode<T>(false) {
+    }
+
+    IntrusivePtr<VectorNode<T>> children[VectorNode<T>::kWidth];
+};
+
+// Up to `kWidth` elements, constructed in place as they are added.
+template <typename T>
+struct VectorLeaf : VectorNode<T> {
+    VectorLeaf() : VectorNode<T>(true) {
+    }
+
+    // A throwing copy leaves no element behind: the destructor does not run for a failed
+    // constructor, so the copies made so far are destroyed here.
+    VectorLeaf(const VectorLeaf& other) : VectorNode<T>(true) {
+        try {
+            for (; count < other.count; ++count) {
+                ::new (Values() + count) T(other.Values()[count]);
+            }
+        } catch (...) {
+            while (count) {
+                Values()[--count].~T();
+            }
+            throw;
+        }
+    }
+
+    ~VectorLeaf() {
+        while (count) {
+            Values()[--count].~T();
+        }
+    }
+
+    T* Values() {
+        return std::launder(reinterpret_cast<T*>(storage));
+    }
+
+    const T* Values() const {
+        return std::launder(reinterpret_cast<const T*>(storage));
+    }
+
+    template <typename... Args>
+    void Emplace(Args&&... args) {
+        ::new (Values() + count) T(std::forward<Args>(args)...);
+        ++count;
+    }
+
+    size_t count = 0;
+    alignas(T) std::byte storage[VectorNode<T>::kWidth * sizeof(T)];
+};
+
+template <typename T>
+void VectorNodeDelete::Destroy(VectorNode<T>* node) {
+    if (node->is_leaf) {
+        delete static_cast<VectorLeaf<T>*>(node);
+    } else {
+        delete static_cast<VectorBranch<T>*>(node);
+    }
+}
+
+// Immutable vector as a 32-way trie of `IntrusivePtr`-linked nodes, plus a tail leaf that takes
+// the appends.
+//
+// Copies are O(1) snapshots that share every node. An update copies the nodes on the path to the
+// changed element, at most log32(n) of them, and shares the rest. Updates of a vector that is
+// about to die (`std::move(v).PushBack(x)`) and of a `TransientVector` change nodes in place
+// whenever they are `IsUnique()`, i.e. nobody else can see them, so a batch of updates copies
+// each shared node at most once.
+template <typename T>
+class PersistentVector {
+    using Node = VectorNode<T>;
+    using Branch = VectorBranch<T>;
+    using Leaf = VectorLeaf<T>;
+    using NodePtr = IntrusivePtr<Node>;
+
+    friend class TransientVector<T>;
+
+public:
+    PersistentVector() = default;
+
+    PersistentVector(const PersistentVector&) = default;
+    PersistentVector& operator=(const PersistentVector&) = default;
+
+    PersistentVector(PersistentVector&& other) noexcept
+        : root_(std::move(other.root_)),
+          tail_(std::move(other.tail_)),
+          size_(std::exchange(other.size_, 0)),
+          shift_(std::exchange(other.shift_, Node::kBits)) {
+    }
+
+    PersistentVector& operator=(PersistentVector&& other) noexcept {
+        root_ = std::move(other.root_);
+        tail_ = std::move(other.tail_);
+        size_ = std::exchange(other.size_, 0);
+        shift_ = std::exchange(other.shift_, Node::kBits);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Updates
+
+    PersistentVector PushBack(T value) const& {
+        return PersistentVector(*this).PushBack(std::move(value));
+    }
+
+    PersistentVector PushBack(T value) && {
+        PushBackInPlace(std::move(value));
+        return std::move(*this);
+    }
+
+    PersistentVector PopBack() const& {
+        return PersistentVector(*this).PopBack();
+    }
+
+    PersistentVector PopBack() && {
+        PopBackInPlace();
+        return std::move(*this);
+    }
+
+    PersistentVector Set(size_t index, T value) const& {
+        return PersistentVector(*this).Set(index, std::move(value));
+    }
+
+    PersistentVector Set(size_t index, T value) && {
+        SetInPlace(index, std::move(value));
+        return std::move(*this);
+    }
+
+    // A mutable copy for a batch of updates.
+    TransientVector<T> Transient() const {
+        return TransientVector<T>(*this);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    const T& operator[](size_t index) const {
+        if (index >= TailOffset()) {
+            return AsLeaf(tail_)->Values()[index & Node::kMask];
+        }
+        const Node* node = root_.Get();
+        for (size_t shift = shift_; shift; shift -= Node::kBits) {
+            node = static_cast<const Branch*>(node)->children[(index >> shift) & Node::kMask].Get();
+        }
+        return static_cast<const Leaf*>(node)->Values()[index & Node::kMask];
+    }
+
+    const T& At(size_t index) const {
+        CheckIndex(index);
+        return (*this)[index];
+    }
+
+    const T& Back() const {
+        return (*this)[size_ - 1];
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+
+    bool Empty() const {
+        return size_ == 0;
+    }
+
+    // Calls `f` with every element in order.
+    template <class F>
+    void ForEach(F&& f) const {
+        ForEachInTree(root_.Get(), shift_, f);
+        if (tail_) {
+            const Leaf* tail = AsLeaf(tail_);
+            for (size_t i = 0; i < tail->count; ++i) {
+                f(tail->Values()[i]);
+            }
+        }
+    }
+
+private:
+    static Leaf* AsLeaf(const NodePtr& node) {
+        return static_cast<Leaf*>(node.Get());
+    }
+
+    // The node in `slot`, copied first unless `slot` is its only reference.
+    static Branch* UniqueBranch(NodePtr& slot) {
+        if (!slot.IsUnique()) {
+            slot = NodePtr(new Branch(*static_cast<Branch*>(slot.Get())));
+        }
+        return static_cast<Branch*>(slot.Get());
+    }
+
+    static Leaf* UniqueLeaf(NodePtr& slot) {
+        if (!slot.IsUnique()) {
+            slot = NodePtr(new Leaf(*AsLeaf(slot)));
+        }
+        return AsLeaf(slot);
+    }
+
+    void CheckIndex(size_t index) const {
+        if (index >= size_) {
+            throw std::out_of_range("PersistentVector: index out of range");
+        }
+    }
+
+    // Number of elements in the trie; the others are in the tail.
+    size_t TailOffset() const {
+        return size_ < Node::kWidth ? 0 : (size_ - 1) & ~Node::kMask;
+    }
+
+    void PushBackInPlace(T&& value) {
+        if (size_ - TailOffset() < Node::kWidth && tail_) {
+            UniqueLeaf(tail_)->Emplace(std::move(value));
+            ++size_;
+            return;
+        }
+        if (tail_) {
+            PushTail();
+        }
+        auto leaf = new Leaf();
+        tail_ = NodePtr(leaf);
+        leaf->Emplace(std::move(value));
+        ++size_;
+    }
+
+    // Moves the full tail into the trie.
+    void PushTail() {
+        if (!root_) {
+            root_ = NodePtr(new Branch());
+        } else if ((size_ >> Node::kBits) > (size_t{1} << shift_)) {
+            auto root = new Branch();
+            root->children[0] = std::move(root_);
+            root->children[1] = NewPath(shift_, std::move(tail_));
+            root_ = NodePtr(root);
+            shift_ += Node::kBits;
+            return;
+        }
+        NodePtr* slot = &root_;
+        for (size_t shift = shift_;; shift -= Node::kBits) {
+            NodePtr& child = UniqueBranch(*slot)->children[((size_ - 1) >> shift) & Node::kMask];
+            if (shift == Node::kBits) {
+                child = std::move(tail_);
+                return;
+            }
+            if (!child) {
+                child = NewPath(shift - Node::kBits, std::move(tail_));
+                return;
+            }
+            slot = &child;
+        }
+    }
+
+    // A chain of branches from level `shift` down to `leaf`.
+    static NodePtr NewPath(size_t shift, NodePtr leaf) {
+        if (!shift) {
+            return leaf;
+        }
+        auto branch = new Branch();
+        branch->children[0] = NewPath(shift - Node::kBits, std::move(leaf));
+        return NodePtr(branch);
+    }
+
+    void PopBackInPlace() {
+        if (!size_) {
+            throw std::out_of_range("PersistentVector: pop from an empty vector");
+        }
+        if (size_ == 1) {
+            *this = PersistentVector();
+            return;
+        }
+        if (size_ - TailOffset() > 1) {
+            Leaf* tail = UniqueLeaf(tail_);
+            tail->Values()[--tail->count].~T();
+            --size_;
+            return;
+        }
+        // The tail is about to become empty: the last leaf of the trie takes its place.
+        NodePtr* slot = &root_;
+        for (size_t shift = shift_; shift; shift -= Node::kBits) {
+            slot = &static_cast<Branch*>(slot->Get())->children[((size_ - 2) >> shift) & Node::kMask];
+        }
+        tail_ = *slot;
+        PopTail(root_, shift_);
+        if (!root_) {
+            shift_ = Node::kBits;
+        } else if (shift_ > Node::kBits && !static_cast<Branch*>(root_.Get())->children[1]) {
+            root_ = NodePtr(static_cast<Branch*>(root_.Get())->children[0]);
+            shift_ -= Node::kBits;
+        }
+        --size_;
+    }
+
+    // Removes the last leaf of the trie, and the branches left empty.
+    void PopTail(NodePtr& slot, size_t shift) {
+        size_t index = ((size_ - 2) >> shift) & Node::kMask;
+        NodePtr& child = UniqueBranch(slot)->children[index];
+        if (shift > Node::kBits) {
+            PopTail(child, shift - Node::kBits);
+        } else {
+            child.Reset();
+        }
+        if (!child && !index) {
+            slot.Reset();
+        }
+    }
+
+    void SetInPlace(size_t index, T&& value) {
+        CheckIndex(index);
+        if (index >= TailOffset()) {
+            UniqueLeaf(tail_)->Values()[index & Node::kMask] = std::move(value);
+            return;
+        }
+        NodePtr* slot = &root_;
+        for (size_t shift = shift_; shift; shift -= Node::kBits) {
+            slot = &UniqueBranch(*slot)->children[(index >> shift) & Node::kMask];
+        }
+        UniqueLeaf(*slot)->Values()[index & Node::kMask] = std::move(value);
+    }
+
+    template <class F>
+    static void ForEachInTree(const Node* node, size_t shift, F& f) {
+        if (!node) {
+            return;
+        }
+        if (node->is_leaf) {
+            auto leaf = static_cast<const Leaf*>(node);
+            for (size_t i = 0; i < leaf->count; ++i) {
+                f(leaf->Values()[i]);
+            }
+            return;
+        }
+        for (const NodePtr& child : static_cast<const Branch*>(node)->children) {
+            ForEachInTree(child.Get(), shift - Node::kBits, f);
+        }
+    }
+
+    NodePtr root_;
+    NodePtr tail_;
+    size_t size_ = 0;
+    size_t shift_ = Node::kBits;
+};
+
+// Mutable handle for a batch of updates to a `PersistentVector`. Starts as an O(1) snapshot; the
+// first update of a shared node copies it, and later updates change the copy in place.
+template <typename T>
+class TransientVector {
+public:
+    explicit TransientVector(PersistentVector<T> vector) : vector_(std::move(vector)) {
+    }
+
+    void PushBack(T value) {
+        vector_.PushBackInPlace(std::move(value));
+    }
+
+    void PopBack() {
+        vector_.PopBackInPlace();
+    }
+
+    void Set(size_t index, T value) {
+        vector_.SetInPlace(index, std::move(value));
+    }
+
+    const T& operator[](size_t index) const {
+        return vector_[index];
+    }
+
+    size_t Size() const {
+        return vector_.Size();
+    }
+
+    // The result of the batch. The transient is left empty.
+    PersistentVector<T> Persistent() {
+        return std::move(vector_);
+    }
+
+private:
+    PersistentVector<T> vector_;
+};
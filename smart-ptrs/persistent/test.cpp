@@ -0,0 +1,253 @@
+#include "persistent_map.h"
+#include "persistent_vector.h"
+
+#include <catch.hpp>
+
+#include "allocations_checker.h"
+
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+template <typename T>
+std::vector<T> ToVector(const PersistentVector<T>& vector) {
+    std::vector<T> result;
+    vector.ForEach([&](const T& value) { result.push_back(value); });
+    return result;
+}
+
+template <typename K, typename V, typename H>
+std::unordered_map<K, V> ToMap(const PersistentMap<K, V, H>& map) {
+    std::unordered_map<K, V> result;
+    map.ForEach([&](const K& key, const V& value) { result.emplace(key, value); });
+    return result;
+}
+
+struct Collider {
+    int value;
+
+    bool operator==(const Collider&) const = default;
+};
+
+struct CollidingHash {
+    size_t operator()(const Collider& key) const {
+        return key.value % 3;
+    }
+};
+
+struct Tracked {
+    explicit Tracked(int value) : value(value) {
+        ++alive;
+    }
+
+    Tracked(const Tracked& other) : value(other.value) {
+        if (copies_left == 0) {
+            throw std::runtime_error("Tracked: copy failed");
+        }
+        --copies_left;
+        ++alive;
+    }
+
+    Tracked& operator=(const Tracked&) = default;
+
+    ~Tracked() {
+        --alive;
+    }
+
+    int value;
+
+    static inline int alive = 0;
+    static inline int copies_left = -1;  // Copies before one throws; negative never throws.
+};
+
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Vector basics") {
+    PersistentVector<int> empty;
+    REQUIRE(empty.Empty());
+    REQUIRE_THROWS_AS(empty.At(0), std::out_of_range);
+    REQUIRE_THROWS_AS(empty.PopBack(), std::out_of_range);
+
+    auto one = empty.PushBack(1);
+    auto two = one.PushBack(2);
+    REQUIRE(empty.Size() == 0);
+    REQUIRE(one.Size() == 1);
+    REQUIRE(two.Back() == 2);
+    REQUIRE(two.Set(0, 5)[0] == 5);
+    REQUIRE(two[0] == 1);
+    REQUIRE(two.PopBack().PopBack().Empty());
+}
+
+TEST_CASE("Vector snapshots") {
+    constexpr int kSize = 100'000;
+    PersistentVector<int> vector;
+    std::vector<PersistentVector<int>> snapshots;
+    for (int i = 0; i < kSize; ++i) {
+        vector = std::move(vector).PushBack(i);
+        if (i % 10'000 == 0) {
+            snapshots.push_back(vector);
+        }
+    }
+    REQUIRE(vector.Size() == kSize);
+    for (int i = 0; i < kSize; i += 997) {
+        REQUIRE(vector[i] == i);
+    }
+
+    auto changed = vector.Set(12'345, -1).Set(kSize - 1, -2);
+    REQUIRE(changed[12'345] == -1);
+    REQUIRE(changed.Back() == -2);
+    REQUIRE(vector[12'345] == 12'345);
+
+    for (size_t i = 0; i < snapshots.size(); ++i) {
+        REQUIRE(snapshots[i].Size() == i * 10'000 + 1);
+        REQUIRE(snapshots[i].Back() == static_cast<int>(i * 10'000));
+    }
+
+    while (vector.Size() > 1000) {
+        vector = std::move(vector).PopBack();
+    }
+    auto values = ToVector(vector);
+    REQUIRE(values.size() == 1000);
+    REQUIRE(values.back() == 999);
+    REQUIRE(ToVector(snapshots.back()).size() == 90'001);
+}
+
+TEST_CASE("Vector transients") {
+    PersistentVector<std::string> vector;
+    for (int i = 0; i < 5000; ++i) {
+        vector = std::move(vector).PushBack(std::to_string(i));
+    }
+    auto transient = vector.Transient();
+    transient.Set(100, "changed");
+    EXPECT_ZERO_ALLOCATIONS(transient.Set(101, "x"));
+    for (int i = 0; i < 100; ++i) {
+        transient.PushBack("new");
+        transient.PopBack();
+    }
+    transient.PopBack();
+    auto result = transient.Persistent();
+    REQUIRE(transient.Size() == 0);
+    REQUIRE(result.Size() == 4999);
+    REQUIRE(result[100] == "changed");
+    REQUIRE(result[101] == "x");
+    REQUIRE(vector[100] == "100");
+    REQUIRE(vector.Back() == "4999");
+}
+
+TEST_CASE("Vector element lifetimes") {
+    {
+        PersistentVector<Tracked> vector;
+        for (int i = 0; i < 1000; ++i) {
+            vector = std::move(vector).PushBack(Tracked(i));
+        }
+        REQUIRE(Tracked::alive == 1000);
+        auto copy = vector.Set(0, Tracked(-1));
+        REQUIRE(Tracked::alive == 1000 + 32);
+        copy = std::move(copy).PopBack();
+    }
+    REQUIRE(Tracked::alive == 0);
+}
+
+TEST_CASE("Vector failed leaf copy") {
+    {
+        PersistentVector<Tracked> vector;
+        for (int i = 0; i < 100; ++i) {
+            vector = std::move(vector).PushBack(Tracked(i));
+        }
+        REQUIRE(Tracked::alive == 100);
+
+        Tracked::copies_left = 10;
+        REQUIRE_THROWS_AS(vector.Set(0, Tracked(-1)), std::runtime_error);
+        Tracked::copies_left = -1;
+        REQUIRE(Tracked::alive == 100);
+        REQUIRE(vector[0].value == 0);
+        REQUIRE(vector.Size() == 100);
+    }
+    REQUIRE(Tracked::alive == 0);
+}
+
+TEST_CASE("Map basics") {
+    PersistentMap<std::string, int> empty;
+    auto map = empty.Set("one", 1).Set("two", 2).Set("one", 11);
+    REQUIRE(empty.Empty());
+    REQUIRE(map.Size() == 2);
+    REQUIRE(map.At("one") == 11);
+    REQUIRE(map.Find("three") == nullptr);
+    REQUIRE_THROWS_AS(map.At("three"), std::out_of_range);
+
+    auto smaller = map.Erase("one").Erase("missing");
+    REQUIRE(smaller.Size() == 1);
+    REQUIRE(map.Contains("one"));
+    REQUIRE(smaller.Erase("two").Empty());
+}
+
+TEST_CASE("Map against unordered_map") {
+    std::mt19937 gen(7);
+    std::unordered_map<int, int> expected;
+    PersistentMap<int, int> map;
+    std::vector<std::pair<PersistentMap<int, int>, std::unordered_map<int, int>>> snapshots;
+    for (int i = 0; i < 200'000; ++i) {
+        int key = static_cast<int>(gen() % 50'000);
+        if (gen() % 3) {
+            expected[key] = i;
+            map = std::move(map).Set(key, i);
+        } else {
+            expected.erase(key);
+            map = std::move(map).Erase(key);
+        }
+        if (i % 40'000 == 0) {
+            snapshots.emplace_back(map, expected);
+        }
+    }
+    REQUIRE(map.Size() == expected.size());
+    REQUIRE(ToMap(map) == expected);
+    for (const auto& [snapshot, values] : snapshots) {
+        REQUIRE(ToMap(snapshot) == values);
+    }
+}
+
+TEST_CASE("Map transients") {
+    PersistentMap<int, std::string> map;
+    for (int i = 0; i < 10'000; ++i) {
+        map = std::move(map).Set(i, std::to_string(i));
+    }
+    auto transient = map.Transient();
+    for (int i = 0; i < 10'000; i += 2) {
+        transient.Erase(i);
+    }
+    transient.Set(1, "one");
+    auto result = transient.Persistent();
+    REQUIRE(result.Size() == 5000);
+    REQUIRE(result.At(1) == "one");
+    REQUIRE(!result.Contains(2));
+    REQUIRE(map.Size() == 10'000);
+    REQUIRE(map.At(1) == "1");
+}
+
+TEST_CASE("Map collisions") {
+    PersistentMap<Collider, int, CollidingHash> map;
+    for (int i = 0; i < 30; ++i) {
+        map = std::move(map).Set({i}, i);
+    }
+    REQUIRE(map.Size() == 30);
+    for (int i = 0; i < 30; ++i) {
+        REQUIRE(map.At({i}) == i);
+    }
+    for (int i = 0; i < 30; i += 3) {
+        map = std::move(map).Erase({i});
+    }
+    REQUIRE(map.Size() == 20);
+    REQUIRE(!map.Contains({0}));
+    REQUIRE(map.At({29}) == 29);
+    int sum = 0;
+    map.ForEach([&](const Collider& key, int value) { sum += key.value == value ? 1 : 0; });
+    REQUIRE(sum == 20);
+}
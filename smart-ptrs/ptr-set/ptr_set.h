@@ -0,0 +1,547 @@
+#pragma once
+
+#include <shared-from-this/shared.h>
+#include <shared-from-this/weak.h>
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Owner-based hashing and ordering
+
+// Hash of the control block, the same for all `SharedPtr`s and `WeakPtr`s of one object. Unlike the
+// stored pointer it stays meaningful after the object dies: its memory may be reused by another
+// object, but the block is pinned by the weak references.
+struct OwnerHash {
+    template <class P>
+    size_t operator()(const P& ptr) const {
+        return std::hash<const void*>{}(ptr.GetBlock());
+    }
+};
+
+// Strict weak ordering of the control blocks, for `std::map` and friends.
+struct OwnerLess {
+    using is_transparent = void;
+
+    template <class P, class Q>
+    bool operator()(const P& left, const Q& right) const {
+        return std::less<const void*>{}(left.GetBlock(), right.GetBlock());
+    }
+};
+
+template <class P, class Q>
+bool OwnerEqual(const P& left, const Q& right) {
+    return left.GetBlock() == right.GetBlock();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Keys
+
+// How a pointer type is keyed: `Identity` is the address that tells keys apart. Pointers with a
+// `Get()` are keyed by the object they point to and can be looked up by a raw pointer to it.
+template <class P>
+struct PtrKeyTraits {
+    using Element = std::remove_pointer_t<decltype(std::declval<const P&>().Get())>;
+
+    static const void* Identity(const P& ptr) {
+        return ptr.Get();
+    }
+
+    static const void* Identity(const Element* ptr) {
+        return ptr;
+    }
+};
+
+// A `WeakPtr` is keyed by its owner, so that an expired key never matches a new object at the same
+// address. It is looked up by any `WeakPtr` or `SharedPtr` of the same object.
+template <class T, class Policy>
+struct PtrKeyTraits<WeakPtr<T, Policy>> {
+    template <class U>
+    static const void* Identity(const WeakPtr<U, Policy>& ptr) {
+        return ptr.GetBlock();
+    }
+
+    template <class U>
+    static const void* Identity(const SharedPtr<U, Policy>& ptr) {
+        return ptr.GetBlock();
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Probing
+
+// Control bytes of 16 consecutive slots. A full slot holds the low 7 bits of its hash, the other
+// states have the high bit set, so one comparison filters a whole group.
+class PtrProbeGroup {
+public:
+    static constexpr size_t kWidth = 16;
+    static constexpr int8_t kEmpty = -128;
+    static constexpr int8_t kDeleted = -2;
+
+    explicit PtrProbeGroup(const int8_t* ctrl) {
+#ifdef __SSE2__
+        ctrl_ = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl));
+#else
+        ctrl_ = ctrl;
+#endif
+    }
+
+    // Bit masks of the slots in the group.
+    uint32_t Match(int8_t h2) const {
+#ifdef __SSE2__
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl_, _mm_set1_epi8(h2)));
+#else
+        return MaskOf([h2](int8_t c) { return c == h2; });
+#endif
+    }
+
+    uint32_t MatchEmpty() const {
+#ifdef __SSE2__
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl_, _mm_set1_epi8(kEmpty)));
+#else
+        return MaskOf([](int8_t c) { return c == kEmpty; });
+#endif
+    }
+
+    uint32_t MatchEmptyOrDeleted() const {
+#ifdef __SSE2__
+        return _mm_movemask_epi8(ctrl_);
+#else
+        return MaskOf([](int8_t c) { return c < 0; });
+#endif
+    }
+
+private:
+#ifdef __SSE2__
+    __m128i ctrl_;
+#else
+    template <class F>
+    uint32_t MaskOf(F f) const {
+        uint32_t mask = 0;
+        for (size_t i = 0; i < kWidth; ++i) {
+            mask |= static_cast<uint32_t>(f(ctrl_[i])) << i;
+        }
+        return mask;
+    }
+
+    const int8_t* ctrl_;
+#endif
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// PtrMap
+
+struct PtrSetNoValue {};
+
+// Hash map keyed by the identity of a smart pointer (`SharedPtr`, `IntrusivePtr`, `UniquePtr` or
+// `WeakPtr`, see `PtrKeyTraits`), which owns the key like a container of the pointers would.
+//
+// Open addressing in the SwissTable layout: a byte of metadata per slot, probed 16 slots at a time
+// with SSE2 where available. Lookups take a raw `T*` (or another pointer with the same identity)
+// and never touch the reference counts, so a map from an object to its owning pointer does not
+// need a parallel `T*` index. Keys are immutable; erased slots become tombstones that are cleared
+// when the table grows.
+template <class P, class V>
+class PtrMap {
+    using Traits = PtrKeyTraits<P>;
+    using Group = PtrProbeGroup;
+
+    struct Entry {
+        P key;
+        [[no_unique_address]] V value;
+    };
+
+    static_assert(std::is_nothrow_move_constructible_v<Entry>,
+                  "PtrMap moves entries when it grows and cannot roll that back");
+
+public:
+    PtrMap() = default;
+
+    PtrMap(const PtrMap& other)
+        requires std::is_copy_constructible_v<P> && std::is_copy_constructible_v<V>
+        : ctrl_(other.ctrl_), size_(other.size_), deleted_(other.deleted_) {
+        slots_ = Allocate(Capacity());
+        size_t copied = 0;
+        try {
+            for (; copied < Capacity(); ++copied) {
+                if (ctrl_[copied] >= 0) {
+                    ::new (slots_ + copied) Entry(other.slots_[copied]);
+                }
+            }
+        } catch (...) {
+            while (copied--) {
+                if (ctrl_[copied] >= 0) {
+                    slots_[copied].~Entry();
+                }
+            }
+            Deallocate(slots_, Capacity());
+            throw;
+        }
+    }
+
+    PtrMap(PtrMap&& other) noexcept
+        : ctrl_(std::move(other.ctrl_)),
+          slots_(std::exchange(other.slots_, nullptr)),
+          size_(std::exchange(other.size_, 0)),
+          deleted_(std::exchange(other.deleted_, 0)) {
+        other.ctrl_.clear();
+    }
+
+    PtrMap& operator=(PtrMap other) noexcept {
+        Swap(other);
+        return *this;
+    }
+
+    ~PtrMap() {
+        Destroy();
+    }
+
+    void Swap(PtrMap& other) noexcept {
+        std::swap(ctrl_, other.ctrl_);
+        std::swap(slots_, other.slots_);
+        std::swap(size_, other.size_);
+        std::swap(deleted_, other.deleted_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    // Inserts the entry unless the key is already present. Returns whether it was inserted.
+    bool Insert(P key, V value) {
+        const void* identity = Traits::Identity(key);
+        uint64_t hash = HashOf(identity);
+        if (FindSlot(identity, hash) != kNone) {
+            return false;
+        }
+        Emplace(hash, std::move(key), std::move(value));
+        return true;
+    }
+
+    // Inserts the entry or replaces the value of the key. Returns whether it was inserted.
+    bool InsertOrAssign(P key, V value) {
+        const void* identity = Traits::Identity(key);
+        uint64_t hash = HashOf(identity);
+        if (size_t slot = FindSlot(identity, hash); slot != kNone) {
+            slots_[slot].value = std::move(value);
+            return false;
+        }
+        Emplace(hash, std::move(key), std::move(value));
+        return true;
+    }
+
+    // Returns whether the key was present.
+    template <class K>
+    bool Erase(const K& key) {
+        const void* identity = Traits::Identity(key);
+        size_t slot = FindSlot(identity, HashOf(identity));
+        if (slot == kNone) {
+            return false;
+        }
+        // A group that still has an empty slot has never been full, so no probe went past it and
+        // the slot may become empty again instead of a tombstone.
+        size_t group = slot & ~(Group::kWidth - 1);
+        if (Group(ctrl_.data() + group).MatchEmpty()) {
+            ctrl_[slot] = Group::kEmpty;
+        } else {
+            ctrl_[slot] = Group::kDeleted;
+            ++deleted_;
+        }
+        --size_;
+        slots_[slot].~Entry();
+        return true;
+    }
+
+    void Clear() {
+        Destroy();
+        ctrl_.clear();
+        slots_ = nullptr;
+        size_ = 0;
+        deleted_ = 0;
+    }
+
+    // Makes room for `count` entries without rehashing.
+    void Reserve(size_t count) {
+        size_t capacity = Group::kWidth;
+        while (capacity * kMaxLoadNum / kMaxLoadDen < count) {
+            capacity *= 2;
+        }
+        if (capacity > Capacity()) {
+            Rehash(capacity);
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Lookup
+
+    // The value of the key, or nullptr.
+    template <class K>
+    V* Find(const K& key) {
+        size_t slot = FindSlot(key);
+        return slot == kNone ? nullptr : &slots_[slot].value;
+    }
+
+    template <class K>
+    const V* Find(const K& key) const {
+        size_t slot = FindSlot(key);
+        return slot == kNone ? nullptr : &slots_[slot].value;
+    }
+
+    // The stored pointer with the identity of `key`, or nullptr.
+    template <class K>
+    const P* FindKey(const K& key) const {
+        size_t slot = FindSlot(key);
+        return slot == kNone ? nullptr : &slots_[slot].key;
+    }
+
+    template <class K>
+    V& At(const K& key) {
+        if (V* value = Find(key)) {
+            return *value;
+        }
+        throw std::out_of_range("PtrMap: no such key");
+    }
+
+    template <class K>
+    const V& At(const K& key) const {
+        if (const V* value = Find(key)) {
+            return *value;
+        }
+        throw std::out_of_range("PtrMap: no such key");
+    }
+
+    template <class K>
+    bool Contains(const K& key) const {
+        return FindSlot(key) != kNone;
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+
+    bool Empty() const {
+        return size_ == 0;
+    }
+
+    size_t Capacity() const {
+        return ctrl_.size();
+    }
+
+    // Calls `f(key, value)` for every entry, in no particular order.
+    template <class F>
+    void ForEach(F&& f) const {
+        for (size_t i = 0; i < Capacity(); ++i) {
+            if (ctrl_[i] >= 0) {
+                f(slots_[i].key, slots_[i].value);
+            }
+        }
+    }
+
+private:
+    static constexpr size_t kNone = static_cast<size_t>(-1);
+    // Maximal share of full and deleted slots.
+    static constexpr size_t kMaxLoadNum = 7;
+    static constexpr size_t kMaxLoadDen = 8;
+
+    static uint64_t HashOf(const void* identity) {
+        uint64_t hash = reinterpret_cast<uintptr_t>(identity);
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+        hash *= 0xc4ceb9fe1a85ec53ULL;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
+    // The low 7 bits of the hash go to the control byte, the rest chooses the first group.
+    static int8_t H2(uint64_t hash) {
+        return static_cast<int8_t>(hash & 0x7f);
+    }
+
+    static Entry* Allocate(size_t capacity) {
+        return capacity ? std::allocator<Entry>().allocate(capacity) : nullptr;
+    }
+
+    static void Deallocate(Entry* slots, size_t capacity) {
+        if (slots) {
+            std::allocator<Entry>().deallocate(slots, capacity);
+        }
+    }
+
+    // Visits the groups of the probe sequence of `hash`: triangular steps over a power-of-two
+    // number of groups reach every group. Stops when `f` returns true.
+    template <class F>
+    void Probe(uint64_t hash, F f) const {
+        size_t groups_mask = Capacity() / Group::kWidth - 1;
+        size_t group = (hash >> 7) & groups_mask;
+        for (size_t step = 1;; ++step) {
+            if (f(group * Group::kWidth)) {
+                return;
+            }
+            group = (group + step) & groups_mask;
+        }
+    }
+
+    template <class K>
+    size_t FindSlot(const K& key) const {
+        const void* identity = Traits::Identity(key);
+        return FindSlot(identity, HashOf(identity));
+    }
+
+    size_t FindSlot(const void* identity, uint64_t hash) const {
+        if (!size_) {
+            return kNone;
+        }
+        size_t result = kNone;
+        Probe(hash, [&](size_t base) {
+            Group group(ctrl_.data() + base);
+            for (uint32_t match = group.Match(H2(hash)); match; match &= match - 1) {
+                size_t slot = base + std::countr_zero(match);
+                if (Traits::Identity(slots_[slot].key) == identity) {
+                    result = slot;
+                    return true;
+                }
+            }
+            return group.MatchEmpty() != 0;
+        });
+        return result;
+    }
+
+    // Stores a key that is known to be absent.
+    void Emplace(uint64_t hash, P&& key, V&& value) {
+        if ((size_ + deleted_ + 1) * kMaxLoadDen > Capacity() * kMaxLoadNum) {
+            // Mostly tombstones: clean them up in place instead of growing.
+            size_t capacity = Capacity() ? Capacity() : Group::kWidth;
+            if ((size_ + 1) * kMaxLoadDen * 2 > capacity * kMaxLoadNum) {
+                capacity *= 2;
+            }
+            Rehash(capacity);
+        }
+        size_t slot = FreeSlot(hash);
+        if (ctrl_[slot] == Group::kDeleted) {
+            --deleted_;
+        }
+        ::new (slots_ + slot) Entry{std::move(key), std::move(value)};
+        ctrl_[slot] = H2(hash);
+        ++size_;
+    }
+
+    size_t FreeSlot(uint64_t hash) const {
+        size_t slot = kNone;
+        Probe(hash, [&](size_t base) {
+            if (uint32_t free = Group(ctrl_.data() + base).MatchEmptyOrDeleted()) {
+                slot = base + std::countr_zero(free);
+                return true;
+            }
+            return false;
+        });
+        return slot;
+    }
+
+    // Allocates everything before touching the table, so that a failed allocation leaves it as it
+    // was. Moving the entries cannot fail.
+    void Rehash(size_t capacity) {
+        Entry* slots = Allocate(capacity);
+        std::vector<int8_t> old_ctrl;
+        try {
+            old_ctrl.assign(capacity, Group::kEmpty);
+        } catch (...) {
+            Deallocate(slots, capacity);
+            throw;
+        }
+        old_ctrl.swap(ctrl_);
+        Entry* old_slots = std::exchange(slots_, slots);
+        deleted_ = 0;
+        for (size_t i = 0; i < old_ctrl.size(); ++i) {
+            if (old_ctrl[i] < 0) {
+                continue;
+            }
+            Entry& entry = old_slots[i];
+            uint64_t hash = HashOf(Traits::Identity(entry.key));
+            size_t slot = FreeSlot(hash);
+            ::new (slots_ + slot) Entry(std::move(entry));
+            ctrl_[slot] = H2(hash);
+            entry.~Entry();
+        }
+        Deallocate(old_slots, old_ctrl.size());
+    }
+
+    void Destroy() {
+        if (!slots_) {
+            return;
+        }
+        for (size_t i = 0; i < Capacity(); ++i) {
+            if (ctrl_[i] >= 0) {
+                slots_[i].~Entry();
+            }
+        }
+        Deallocate(slots_, Capacity());
+    }
+
+    std::vector<int8_t> ctrl_;
+    Entry* slots_ = nullptr;
+    size_t size_ = 0;
+    size_t deleted_ = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// PtrSet
+
+// Set of smart pointers by identity, see `PtrMap`.
+template <class P>
+class PtrSet {
+public:
+    // Returns whether the pointer was inserted.
+    bool Insert(P ptr) {
+        return map_.Insert(std::move(ptr), {});
+    }
+
+    template <class K>
+    bool Erase(const K& key) {
+        return map_.Erase(key);
+    }
+
+    void Clear() {
+        map_.Clear();
+    }
+
+    void Reserve(size_t count) {
+        map_.Reserve(count);
+    }
+
+    // The stored pointer with the identity of `key`, or nullptr.
+    template <class K>
+    const P* Find(const K& key) const {
+        return map_.FindKey(key);
+    }
+
+    template <class K>
+    bool Contains(const K& key) const {
+        return map_.Contains(key);
+    }
+
+    size_t Size() const {
+        return map_.Size();
+    }
+
+    bool Empty() const {
+        return map_.Empty();
+    }
+
+    template <class F>
+    void ForEach(F&& f) const {
+        map_.ForEach([&f](const P& ptr, PtrSetNoValue) { f(ptr); });
+    }
+
+private:
+    PtrMap<P, PtrSetNoValue> map_;
+};
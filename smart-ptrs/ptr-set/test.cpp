@@ -0,0 +1,237 @@
+#include "ptr_set.h"
+
+#include <intrusive/intrusive.h>
+#include <unique/unique.h>
+
+#include <catch.hpp>
+
+#include "allocations_checker.h"
+
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Node : SimpleRefCounted<Node> {
+    explicit Node(int value) : value(value) {
+    }
+
+    int value;
+};
+
+struct Counted {
+    explicit Counted(int* alive) : alive(alive) {
+        ++*alive;
+    }
+
+    ~Counted() {
+        --*alive;
+    }
+
+    int* alive;
+};
+
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Set of SharedPtr") {
+    PtrSet<SharedPtr<std::string>> set;
+    auto a = MakeShared<std::string>("a");
+    auto b = MakeShared<std::string>("b");
+    REQUIRE(set.Insert(a));
+    REQUIRE(set.Insert(b));
+    REQUIRE_FALSE(set.Insert(a));
+    REQUIRE(set.Size() == 2);
+    REQUIRE(a.UseCount() == 2);
+
+    std::string* raw = a.Get();
+    const SharedPtr<std::string>* found = nullptr;
+    EXPECT_ZERO_ALLOCATIONS(found = set.Find(raw));
+    REQUIRE(found);
+    REQUIRE(*found == a);
+    REQUIRE(a.UseCount() == 2);
+    REQUIRE(set.Contains(b));
+    REQUIRE_FALSE(set.Contains(MakeShared<std::string>("a").Get()));
+
+    // Identity, not equality: an equal string is another key.
+    REQUIRE(set.Insert(MakeShared<std::string>("a")));
+    REQUIRE(set.Size() == 3);
+
+    REQUIRE(set.Erase(raw));
+    REQUIRE_FALSE(set.Erase(raw));
+    REQUIRE(a.UseCount() == 1);
+    size_t strings = 0;
+    set.ForEach([&](const SharedPtr<std::string>& ptr) { strings += ptr->size(); });
+    REQUIRE(strings == 2);
+    set.Clear();
+    REQUIRE(set.Empty());
+    REQUIRE(b.UseCount() == 1);
+}
+
+TEST_CASE("Map against std::unordered_map") {
+    std::mt19937 rng(42);
+    std::vector<SharedPtr<int>> objects;
+    for (int i = 0; i < 1000; ++i) {
+        objects.push_back(MakeShared<int>(i));
+    }
+    PtrMap<SharedPtr<int>, int> map;
+    std::unordered_map<const int*, int> expected;
+    for (int step = 0; step < 50000; ++step) {
+        const auto& object = objects[rng() % objects.size()];
+        int value = static_cast<int>(rng());
+        switch (rng() % 3) {
+            case 0:
+                REQUIRE(map.Insert(object, value) == expected.emplace(object.Get(), value).second);
+                break;
+            case 1:
+                REQUIRE(map.InsertOrAssign(object, value) ==
+                        !expected.contains(object.Get()));
+                expected[object.Get()] = value;
+                break;
+            case 2:
+                REQUIRE(map.Erase(object.Get()) == (expected.erase(object.Get()) == 1));
+                break;
+        }
+        REQUIRE(map.Size() == expected.size());
+    }
+    for (const auto& object : objects) {
+        auto it = expected.find(object.Get());
+        const int* value = map.Find(object.Get());
+        REQUIRE((it == expected.end() ? value == nullptr : value && *value == it->second));
+        REQUIRE(object.UseCount() == (it == expected.end() ? 1 : 2));
+    }
+    REQUIRE(map.Size() * 8 <= map.Capacity() * 7);
+    REQUIRE_THROWS_AS(map.At(static_cast<const int*>(nullptr)), std::out_of_range);
+
+    auto copy = map;
+    REQUIRE(copy.Size() == map.Size());
+    map.Clear();
+    for (const auto& [object, value] : expected) {
+        REQUIRE(copy.At(object) == value);
+    }
+}
+
+TEST_CASE("Failed copies") {
+    struct Value {
+        explicit Value(int copies_left) : copies_left(copies_left) {
+        }
+
+        Value(const Value& other) : copies_left(other.copies_left) {
+            if (!copies_left) {
+                throw std::runtime_error("copy failed");
+            }
+        }
+
+        Value(Value&&) noexcept = default;
+
+        int copies_left;
+    };
+
+    using Map = PtrMap<SharedPtr<int>, Value>;
+    std::vector<SharedPtr<int>> objects;
+    Map map;
+    for (int i = 0; i < 100; ++i) {
+        objects.push_back(MakeShared<int>(i));
+        map.Insert(objects.back(), Value(i == 50 ? 0 : 1));
+    }
+    REQUIRE_THROWS_AS(Map(map), std::runtime_error);
+    for (const auto& object : objects) {
+        REQUIRE(object.UseCount() == 2);
+    }
+}
+
+TEST_CASE("Growth and tombstones") {
+    std::vector<SharedPtr<int>> objects;
+    PtrSet<SharedPtr<int>> set;
+    set.Reserve(100);
+    for (int i = 0; i < 100; ++i) {
+        objects.push_back(MakeShared<int>(i));
+        REQUIRE(set.Insert(objects.back()));
+    }
+    // Churn through many more keys than the table holds at any time.
+    for (int i = 0; i < 10000; ++i) {
+        auto object = MakeShared<int>(i);
+        REQUIRE(set.Insert(object));
+        REQUIRE(set.Erase(object.Get()));
+    }
+    REQUIRE(set.Size() == 100);
+    for (const auto& object : objects) {
+        REQUIRE(set.Contains(object.Get()));
+    }
+}
+
+TEST_CASE("IntrusivePtr and UniquePtr keys") {
+    PtrMap<IntrusivePtr<Node>, std::string> nodes;
+    IntrusivePtr<Node> node(new Node(1));
+    nodes.Insert(node, "one");
+    REQUIRE(node->RefCount() == 2);
+    REQUIRE(nodes.At(node.Get()) == "one");
+    REQUIRE(nodes.Find(node) != nullptr);
+    nodes.Erase(node);
+    REQUIRE(node->RefCount() == 1);
+
+    int alive = 0;
+    {
+        PtrSet<UniquePtr<Counted>> owned;
+        std::vector<Counted*> raw;
+        for (int i = 0; i < 40; ++i) {
+            UniquePtr<Counted> ptr(new Counted(&alive));
+            raw.push_back(ptr.Get());
+            owned.Insert(std::move(ptr));
+        }
+        REQUIRE(alive == 40);
+        for (int i = 0; i < 40; i += 2) {
+            REQUIRE(owned.Erase(raw[i]));
+        }
+        REQUIRE(alive == 20);
+        REQUIRE(owned.Find(raw[1])->Get() == raw[1]);
+
+        PtrSet<UniquePtr<Counted>> moved = std::move(owned);
+        REQUIRE(moved.Size() == 20);
+        REQUIRE(owned.Empty());
+    }
+    REQUIRE(alive == 0);
+}
+
+TEST_CASE("WeakPtr keys are owners") {
+    auto object = MakeShared<std::string>("object");
+    WeakPtr<std::string> weak = object;
+
+    PtrMap<WeakPtr<std::string>, int> map;
+    map.Insert(weak, 1);
+    REQUIRE(map.At(object) == 1);
+    REQUIRE(map.At(weak) == 1);
+    REQUIRE(object.UseCount() == 1);
+
+    // An aliasing pointer has the same owner.
+    struct Pair {
+        int first;
+        int second;
+    };
+    auto pair = MakeShared<Pair>();
+    SharedPtr<int> second(pair, &pair->second);
+    PtrSet<WeakPtr<Pair>> pairs;
+    pairs.Insert(WeakPtr<Pair>(pair));
+    REQUIRE(pairs.Contains(second));
+
+    // The key outlives the object and still matches its owner only.
+    object.Reset();
+    REQUIRE(map.Find(weak) != nullptr);
+    auto other = MakeShared<std::string>("other");
+    REQUIRE(map.Find(other) == nullptr);
+    REQUIRE(map.Erase(weak));
+
+    std::set<WeakPtr<Pair>, OwnerLess> ordered;
+    ordered.insert(WeakPtr<Pair>(pair));
+    REQUIRE(ordered.count(WeakPtr<Pair>(pair)) == 1);
+    REQUIRE(ordered.find(second) != ordered.end());
+    REQUIRE(OwnerEqual(second, pair));
+    REQUIRE(OwnerHash{}(second) == OwnerHash{}(WeakPtr<Pair>(pair)));
+}
@@ -0,0 +1,385 @@
+#pragma once
+
+#include <intrusive/intrusive.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// Node of a `Rope`: a leaf holding up to `Rope::kMaxLeaf` characters, or the concatenation of two
+// non-empty subtrees.
+struct RopeNode : AtomicRefCounted<RopeNode> {
+    IntrusivePtr<RopeNode> left;
+    IntrusivePtr<RopeNode> right;
+    std::string text;
+    size_t size = 0;
+    int height = 1;
+
+    bool IsLeaf() const {
+        return !left;
+    }
+};
+
+// Persistent string as an AVL-balanced concatenation tree.
+//
+// Copies share the whole tree, and every edit rebuilds only the O(log n) nodes on the paths it
+// touches; the rest stays shared with older versions. Insert, erase, substring and concatenation
+// all run in O(log n) through `Split` and `Join`. A node nobody else references (`IsUnique()`) is
+// updated in place instead of copied, so a rope that is not shared edits a leaf with no
+// allocation at all.
+class Rope {
+    using NodePtr = IntrusivePtr<RopeNode>;
+
+public:
+    static constexpr size_t kMaxLeaf = 1024;
+
+    Rope() = default;
+
+    explicit Rope(std::string_view text) : root_(Build(text)) {
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Insert(size_t pos, std::string_view text) {
+        CheckPosition(pos);
+        if (text.empty()) {
+            return;
+        }
+        if (const RopeNode* leaf = FindLeaf(root_.Get(), pos);
+            leaf && leaf->size + text.size() <= kMaxLeaf) {
+            InsertIntoLeaf(root_, pos, text);
+            return;
+        }
+        Insert(pos, Rope(text));
+    }
+
+    void Insert(size_t pos, Rope other) {
+        CheckPosition(pos);
+        auto [left, right] = Split(std::move(root_), pos);
+        root_ = Join(Join(std::move(left), std::move(other.root_)), std::move(right));
+    }
+
+    void Erase(size_t pos, size_t count) {
+        CheckPosition(pos);
+        count = std::min(count, Size() - pos);
+        if (!count) {
+            return;
+        }
+        if (EraseFromLeaf(root_, pos, count)) {
+            return;
+        }
+        auto [left, rest] = Split(std::move(root_), pos);
+        auto [erased, right] = Split(std::move(rest), count);
+        root_ = Join(std::move(left), std::move(right));
+    }
+
+    void Append(std::string_view text) {
+        Insert(Size(), text);
+    }
+
+    void Append(Rope other) {
+        root_ = Join(std::move(root_), std::move(other.root_));
+    }
+
+    void Clear() {
+        root_.Reset();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    // `count` characters starting at `pos`, sharing the nodes with this rope.
+    Rope Substr(size_t pos, size_t count = std::string::npos) const {
+        CheckPosition(pos);
+        count = std::min(count, Size() - pos);
+        auto [left, rest] = Split(root_, pos);
+        Rope result;
+        result.root_ = Split(std::move(rest), count).first;
+        return result;
+    }
+
+    char At(size_t pos) const {
+        if (pos >= Size()) {
+            throw std::out_of_range("Rope: position out of range");
+        }
+        const RopeNode* node = root_.Get();
+        while (!node->IsLeaf()) {
+            if (pos < node->left->size) {
+                node = node->left.Get();
+            } else {
+                pos -= node->left->size;
+                node = node->right.Get();
+            }
+        }
+        return node->text[pos];
+    }
+
+    size_t Size() const {
+        return SizeOf(root_);
+    }
+
+    bool Empty() const {
+        return !root_;
+    }
+
+    int Height() const {
+        return HeightOf(root_);
+    }
+
+    // Calls `f` with every leaf in order.
+    template <class F>
+    void ForEachChunk(F&& f) const {
+        ForEachChunk(root_.Get(), f);
+    }
+
+    std::string ToString() const {
+        std::string result;
+        result.reserve(Size());
+        ForEachChunk([&](std::string_view chunk) { result += chunk; });
+        return result;
+    }
+
+    friend Rope operator+(Rope left, Rope right) {
+        left.Append(std::move(right));
+        return left;
+    }
+
+private:
+    static size_t SizeOf(const NodePtr& node) {
+        return node ? node->size : 0;
+    }
+
+    static int HeightOf(const NodePtr& node) {
+        return node ? node->height : 0;
+    }
+
+    static bool IsUnique(const NodePtr& node) {
+        return node.IsUnique();
+    }
+
+    void CheckPosition(size_t pos) const {
+        if (pos > Size()) {
+            throw std::out_of_range("Rope: position out of range");
+        }
+    }
+
+    static NodePtr MakeLeaf(std::string_view text) {
+        NodePtr leaf(new RopeNode());
+        leaf->text = text;
+        leaf->size = text.size();
+        return leaf;
+    }
+
+    // Makes the node safe to modify: copies it unless it is referenced only through `node`.
+    static void MakeUnique(NodePtr& node) {
+        if (!IsUnique(node)) {
+            node = NodePtr(new RopeNode(*node));
+        }
+    }
+
+    // Concatenation of `left` and `right`, stored in `reuse` if nobody else references it.
+    static NodePtr MakeConcat(NodePtr reuse, NodePtr left, NodePtr right) {
+        NodePtr node = IsUnique(reuse) ? std::move(reuse) : NodePtr(new RopeNode());
+        node->size = left->size + right->size;
+        node->height = std::max(left->height, right->height) + 1;
+        node->left = std::move(left);
+        node->right = std::move(right);
+        return node;
+    }
+
+    // The children of a concatenation; moved out if the node is not shared, so that it can be
+    // reused by `MakeConcat`.
+    static std::pair<NodePtr, NodePtr> TakeChildren(NodePtr& node) {
+        if (IsUnique(node)) {
+            return {std::move(node->left), std::move(node->right)};
+        }
+        return {node->left, node->right};
+    }
+
+    // `MakeConcat` plus one single or double rotation, enough when the heights of `left` and
+    // `right` differ by at most two.
+    static NodePtr Balance(NodePtr reuse, NodePtr left, NodePtr right) {
+        if (HeightOf(right) > HeightOf(left) + 1) {
+            auto [middle, outer] = TakeChildren(right);
+            if (HeightOf(middle) > HeightOf(outer)) {
+                auto [middle_left, middle_right] = TakeChildren(middle);
+                NodePtr new_left = MakeConcat(std::move(reuse), std::move(left),
+                                              std::move(middle_left));
+                NodePtr new_right = MakeConcat(std::move(right), std::move(middle_right),
+                                               std::move(outer));
+                return MakeConcat(std::move(middle), std::move(new_left), std::move(new_right));
+            }
+            NodePtr new_left = MakeConcat(std::move(reuse), std::move(left), std::move(middle));
+            return MakeConcat(std::move(right), std::move(new_left), std::move(outer));
+        }
+        if (HeightOf(left) > HeightOf(right) + 1) {
+            auto [outer, middle] = TakeChildren(left);
+            if (HeightOf(middle) > HeightOf(outer)) {
+                auto [middle_left, middle_right] = TakeChildren(middle);
+                NodePtr new_left = MakeConcat(std::move(left), std::move(outer),
+                                              std::move(middle_left));
+                NodePtr new_right = MakeConcat(std::move(reuse), std::move(middle_right),
+                                               std::move(right));
+                return MakeConcat(std::move(middle), std::move(new_left), std::move(new_right));
+            }
+            NodePtr new_right = MakeConcat(std::move(reuse), std::move(middle), std::move(right));
+            return MakeConcat(std::move(left), std::move(outer), std::move(new_right));
+        }
+        return MakeConcat(std::move(reuse), std::move(left), std::move(right));
+    }
+
+    // Concatenation of two balanced trees in O(|height(left) - height(right)|).
+    static NodePtr Join(NodePtr left, NodePtr right) {
+        if (!left) {
+            return right;
+        }
+        if (!right) {
+            return left;
+        }
+        if (left->IsLeaf() && right->IsLeaf() && left->size + right->size <= kMaxLeaf) {
+            MakeUnique(left);
+            left->text += right->text;
+            left->size = left->text.size();
+            return left;
+        }
+        if (left->height > right->height + 1) {
+            auto [outer, inner] = TakeChildren(left);
+            NodePtr joined = Join(std::move(inner), std::move(right));
+            return Balance(std::move(left), std::move(outer), std::move(joined));
+        }
+        if (right->height > left->height + 1) {
+            auto [inner, outer] = TakeChildren(right);
+            NodePtr joined = Join(std::move(left), std::move(inner));
+            return Balance(std::move(right), std::move(joined), std::move(outer));
+        }
+        return MakeConcat(nullptr, std::move(left), std::move(right));
+    }
+
+    // The first `pos` characters and the rest, in O(log n).
+    static std::pair<NodePtr, NodePtr> Split(NodePtr node, size_t pos) {
+        if (!node || pos == 0) {
+            return {nullptr, std::move(node)};
+        }
+        if (pos >= node->size) {
+            return {std::move(node), nullptr};
+        }
+        if (node->IsLeaf()) {
+            NodePtr right = MakeLeaf(std::string_view(node->text).substr(pos));
+            if (IsUnique(node)) {
+                node->text.resize(pos);
+                node->size = pos;
+                return {std::move(node), std::move(right)};
+            }
+            return {MakeLeaf(std::string_view(node->text).substr(0, pos)), std::move(right)};
+        }
+        auto [left, right] = TakeChildren(node);
+        size_t left_size = left->size;
+        if (pos < left_size) {
+            auto [first, second] = Split(std::move(left), pos);
+            return {std::move(first), Join(std::move(second), std::move(right))};
+        }
+        if (pos > left_size) {
+            auto [first, second] = Split(std::move(right), pos - left_size);
+            return {Join(std::move(left), std::move(first)), std::move(second)};
+        }
+        return {std::move(left), std::move(right)};
+    }
+
+    // The leaf that `InsertIntoLeaf` would change.
+    static const RopeNode* FindLeaf(const RopeNode* node, size_t pos) {
+        while (node && !node->IsLeaf()) {
+            if (pos <= node->left->size) {
+                node = node->left.Get();
+            } else {
+                pos -= node->left->size;
+                node = node->right.Get();
+            }
+        }
+        return node;
+    }
+
+    // Inserts into a single leaf, copying only the shared nodes on the path to it. A leaf gets its
+    // full capacity on the first such edit, so that the following ones do not reallocate; leaves
+    // that are never edited keep only what their text needs.
+    static void InsertIntoLeaf(NodePtr& node, size_t pos, std::string_view text) {
+        MakeUnique(node);
+        node->size += text.size();
+        if (node->IsLeaf()) {
+            if (node->text.capacity() < node->size) {
+                node->text.reserve(kMaxLeaf);
+            }
+            node->text.insert(pos, text);
+        } else if (pos <= node->left->size) {
+            InsertIntoLeaf(node->left, pos, text);
+        } else {
+            InsertIntoLeaf(node->right, pos - node->left->size, text);
+        }
+    }
+
+    // Erases a range that lies inside one leaf and leaves it non-empty. Returns false if the range
+    // does not.
+    static bool EraseFromLeaf(NodePtr& root, size_t pos, size_t count) {
+        const RopeNode* leaf = root.Get();
+        size_t leaf_pos = pos;
+        while (!leaf->IsLeaf()) {
+            if (leaf_pos + count <= leaf->left->size) {
+                leaf = leaf->left.Get();
+            } else if (leaf_pos >= leaf->left->size) {
+                leaf_pos -= leaf->left->size;
+                leaf = leaf->right.Get();
+            } else {
+                return false;
+            }
+        }
+        if (count >= leaf->size) {
+            return false;
+        }
+        NodePtr* node = &root;
+        while (true) {
+            MakeUnique(*node);
+            (*node)->size -= count;
+            if ((*node)->IsLeaf()) {
+                (*node)->text.erase(pos, count);
+                return true;
+            }
+            if (pos < (*node)->left->size) {
+                node = &(*node)->left;
+            } else {
+                pos -= (*node)->left->size;
+                node = &(*node)->right;
+            }
+        }
+    }
+
+    // A balanced tree of full leaves.
+    static NodePtr Build(std::string_view text) {
+        if (text.empty()) {
+            return nullptr;
+        }
+        if (text.size() <= kMaxLeaf) {
+            return MakeLeaf(text);
+        }
+        size_t leaves = (text.size() + kMaxLeaf - 1) / kMaxLeaf;
+        size_t middle = leaves / 2 * kMaxLeaf;
+        return MakeConcat(nullptr, Build(text.substr(0, middle)), Build(text.substr(middle)));
+    }
+
+    template <class F>
+    static void ForEachChunk(const RopeNode* node, F& f) {
+        if (!node) {
+            return;
+        }
+        if (node->IsLeaf()) {
+            f(std::string_view(node->text));
+            return;
+        }
+        ForEachChunk(node->left.Get(), f);
+        ForEachChunk(node->right.Get(), f);
+    }
+
+    NodePtr root_;
+};
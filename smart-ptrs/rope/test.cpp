@@ -0,0 +1,162 @@
+#include "rope.h"
+
+#include <catch.hpp>
+
+#include "allocations_checker.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+std::string Text(size_t size, char first = 'a') {
+    std::string text(size, ' ');
+    for (size_t i = 0; i < size; ++i) {
+        text[i] = static_cast<char>(first + i % 26);
+    }
+    return text;
+}
+
+std::set<const char*> Chunks(const Rope& rope) {
+    std::set<const char*> chunks;
+    rope.ForEachChunk([&](std::string_view chunk) { chunks.insert(chunk.data()); });
+    return chunks;
+}
+
+// AVL height bound for a tree over the leaves of a rope of `size` characters.
+int MaxHeight(size_t size) {
+    double leaves = static_cast<double>(size) / 2 + 2;
+    return static_cast<int>(1.45 * std::log2(leaves)) + 2;
+}
+
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Empty") {
+    Rope rope;
+    REQUIRE(rope.Empty());
+    REQUIRE(rope.Size() == 0);
+    REQUIRE(rope.ToString().empty());
+    REQUIRE(rope.Substr(0).Empty());
+    REQUIRE_THROWS_AS(rope.At(0), std::out_of_range);
+    REQUIRE_THROWS_AS(rope.Insert(1, "x"), std::out_of_range);
+    rope.Erase(0, 10);
+    rope.Insert(0, "");
+    REQUIRE(rope.Empty());
+}
+
+TEST_CASE("Basic editing") {
+    Rope rope("Hello world");
+    rope.Insert(5, ",");
+    rope.Append("!");
+    REQUIRE(rope.ToString() == "Hello, world!");
+    REQUIRE(rope.At(7) == 'w');
+    rope.Erase(5, 100);
+    REQUIRE(rope.ToString() == "Hello");
+    REQUIRE((rope + Rope(" there")).ToString() == "Hello there");
+    REQUIRE(rope.Substr(1, 3).ToString() == "ell");
+}
+
+TEST_CASE("Large documents") {
+    std::string text = Text(1 << 20);
+    Rope rope(text);
+    REQUIRE(rope.Size() == text.size());
+    REQUIRE(rope.Height() <= MaxHeight(text.size() / Rope::kMaxLeaf * 2));
+    REQUIRE(rope.ToString() == text);
+
+    Rope middle = rope.Substr(300'000, 400'000);
+    REQUIRE(middle.ToString() == text.substr(300'000, 400'000));
+
+    Rope doubled = rope + rope;
+    REQUIRE(doubled.Size() == 2 * text.size());
+    REQUIRE(doubled.At(text.size() + 5) == text[5]);
+    REQUIRE(doubled.Height() <= rope.Height() + 1);
+}
+
+TEST_CASE("Structural sharing") {
+    std::string text = Text(100'000);
+    Rope original(text);
+    Rope copy = original;
+    copy.Insert(50'000, "inserted");
+    copy.Erase(10, 5);
+    REQUIRE(original.ToString() == text);
+
+    text.insert(50'000, "inserted");
+    text.erase(10, 5);
+    REQUIRE(copy.ToString() == text);
+
+    // Only the two edited leaves were copied.
+    auto before = Chunks(original);
+    auto after = Chunks(copy);
+    std::vector<const char*> shared;
+    std::set_intersection(before.begin(), before.end(), after.begin(), after.end(),
+                          std::back_inserter(shared));
+    REQUIRE(shared.size() + 2 == before.size());
+}
+
+TEST_CASE("In-place edits") {
+    Rope rope(Text(100'000));
+    rope.Erase(1000, 10);
+    EXPECT_ZERO_ALLOCATIONS(rope.Insert(1000, "0123456789"));
+    EXPECT_ZERO_ALLOCATIONS(rope.Erase(2000, 5));
+    REQUIRE(rope.Substr(1000, 10).ToString() == "0123456789");
+
+    std::string text = Text(100);
+    Rope small(text);
+    small.Insert(0, "x");
+    EXPECT_ZERO_ALLOCATIONS(small.Insert(1, "yz"));
+    EXPECT_ZERO_ALLOCATIONS(small.Append(text));
+    REQUIRE(small.ToString() == "xyz" + text + text);
+}
+
+TEST_CASE("Random edits") {
+    std::mt19937 gen(42);
+    std::string expected;
+    Rope rope;
+    std::vector<Rope> versions;
+    std::vector<std::string> expected_versions;
+    for (int i = 0; i < 3000; ++i) {
+        size_t pos = std::uniform_int_distribution<size_t>(0, expected.size())(gen);
+        switch (gen() % 4) {
+            case 0:
+            case 1: {
+                size_t size = std::uniform_int_distribution<size_t>(1, 3000)(gen);
+                std::string text = Text(size, 'A' + i % 26);
+                rope.Insert(pos, text);
+                expected.insert(pos, text);
+                break;
+            }
+            case 2: {
+                size_t size = std::uniform_int_distribution<size_t>(0, 2000)(gen);
+                rope.Erase(pos, size);
+                expected.erase(pos, size);
+                break;
+            }
+            case 3: {
+                size_t size = std::uniform_int_distribution<size_t>(0, 5000)(gen);
+                Rope piece = rope.Substr(pos, size);
+                rope.Append(piece);
+                expected += expected.substr(pos, size);
+                break;
+            }
+        }
+        REQUIRE(rope.Size() == expected.size());
+        if (i % 300 == 0) {
+            versions.push_back(rope);
+            expected_versions.push_back(expected);
+        }
+    }
+    REQUIRE(rope.ToString() == expected);
+    REQUIRE(rope.Height() <= MaxHeight(expected.size()));
+    for (size_t i = 0; i < versions.size(); ++i) {
+        REQUIRE(versions[i].ToString() == expected_versions[i]);
+    }
+}
@@ -3,9 +3,9 @@
 #include "sw_fwd.h"  // Forward declaration
 
 // https://en.cppreference.com/w/cpp/memory/weak_ptr
-template <typename T>
+template <typename T, typename Policy>
 class WeakPtr {
-    template <class U>
+    template <class U, class P>
     friend class SharedPtr;
 
 public:
@@ -18,19 +18,16 @@ public:
         if (!block_) {
             return;
         }
-        block_->AddWeakRef();
+        block_->template AddWeakRef<Policy>();
     }
 
     void DecWeakRef() {
         if (!block_) {
             return;
         }
-        block_->DecWeakRef();
-        if (block_->WholeEmpty()) {
-            delete block_;
-            block_ = nullptr;
-            field_ = nullptr;
-        }
+        block_->template DecWeakRef<Policy>();
+        block_ = nullptr;
+        field_ = nullptr;
     }
 
     WeakPtr(const WeakPtr& other) {
@@ -48,20 +45,20 @@ public:
 
     // Demote `SharedPtr`
     // #2 from https://en.cppreference.com/w/cpp/memory/weak_ptr/weak_ptr
-    WeakPtr(const SharedPtr<T>& other) {
+    WeakPtr(const SharedPtr<T, Policy>& other) {
         block_ = other.GetBlock();
         field_ = other.GetField();
         AddWeakRef();
     }
 
     template <class U>
-    WeakPtr(const SharedPtr<U>& other) {
+    WeakPtr(const SharedPtr<U, Policy>& other) {
         block_ = other.GetBlock();
         field_ = other.GetField();
         AddWeakRef();
     }
 
-    WeakPtr& operator=(const SharedPtr<T>& other) {
+    WeakPtr& operator=(const SharedPtr<T, Policy>& other) {
         DecWeakRef();
         block_ = other.GetBlock();
         field_ = other.GetField();
@@ -73,6 +70,9 @@ public:
     // `operator=`-s
 
     WeakPtr& operator=(const WeakPtr& other) {
+        if (this == &other) {
+            return *this;
+        }
         DecWeakRef();
         block_ = other.block_;
         field_ = other.field_;
@@ -105,8 +105,9 @@ public:
         field_ = nullptr;
     }
 
-    void Swap(WeakPtr& other) {
+    void Swap(WeakPtr& other) noexcept {
         std::swap(block_, other.block_);
+        std::swap(field_, other.field_);
     }
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -126,18 +127,17 @@ public:
         return block_->IsEmpty();
     }
 
-    SharedPtr<T> Lock() const {
-        if (!block_ || block_->IsEmpty()) {
-            return std::move(SharedPtr<T>());
+    // The strong counter may drop to zero concurrently, so it is only bumped while non-zero.
+    SharedPtr<T, Policy> Lock() const {
+        SharedPtr<T, Policy> obj;
+        if (block_ && block_->template AddStrongRefIfNonZero<Policy>()) {
+            obj.GetField() = field_;
+            obj.GetBlock() = block_;
         }
-        SharedPtr<T> obj;
-        obj.GetField() = field_;
-        obj.GetBlock() = block_;
-        obj.AddStrongRef();
-        return std::move(obj);
+        return obj;
     }
 
-    T* GetField() const {
+    std::remove_extent_t<T>* GetField() const {
         return field_;
     }
 
@@ -146,6 +146,6 @@ public:
     }
 
 private:
-    T* field_ = nullptr;
+    std::remove_extent_t<T>* field_ = nullptr;
     BaseBlock* block_ = nullptr;
 };
@@ -0,0 +1,284 @@
+#pragma once
+
+#include <shared-from-this/shared.h>
+
+#include <common/relocatable.h>
+#include <common/relocating_vector.h>
+
+#include <cstddef>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+// A contiguous slice of a reference-counted buffer: a pointer, a length and a strong reference to
+// the buffer's control block, held as an aliasing `SharedPtr`. Slicing never copies elements; a
+// record cut out of a receive buffer keeps the whole buffer alive and can outlive every other
+// reference to it.
+//
+// Slicing a temporary moves its reference into the result, so
+// `std::move(rest).Subspan(n)` touches no counter at all.
+template <typename T>
+class SharedSpan {
+    template <typename U>
+    friend class SharedSpan;
+
+public:
+    static constexpr size_t kNpos = static_cast<size_t>(-1);
+
+    SharedSpan() = default;
+
+    // The whole buffer, e.g. from `MakeShared<T[]>(size)` or `MakeSharedForOverwrite<T[]>(size)`.
+    template <typename U>
+        requires std::is_convertible_v<U (*)[], T (*)[]>
+    SharedSpan(const SharedPtr<U[]>& buffer, size_t size)
+        : data_(buffer, buffer.Get()), size_(size) {
+    }
+
+    // `size` elements at `data`, kept alive by `owner`.
+    template <typename U>
+    SharedSpan(const SharedPtr<U>& owner, T* data, size_t size) : data_(owner, data), size_(size) {
+    }
+
+    template <typename U>
+        requires std::is_convertible_v<U (*)[], T (*)[]>
+    SharedSpan(const SharedSpan<U>& other) : data_(other.data_), size_(other.size_) {
+    }
+
+    template <typename U>
+        requires std::is_convertible_v<U (*)[], T (*)[]>
+    SharedSpan(SharedSpan<U>&& other) noexcept
+        : data_(std::move(other.data_)), size_(std::exchange(other.size_, 0)) {
+    }
+
+    SharedSpan(const SharedSpan&) = default;
+    SharedSpan& operator=(const SharedSpan&) = default;
+
+    SharedSpan(SharedSpan&& other) noexcept
+        : data_(std::move(other.data_)), size_(std::exchange(other.size_, 0)) {
+    }
+
+    SharedSpan& operator=(SharedSpan&& other) noexcept {
+        data_ = std::move(other.data_);
+        size_ = std::exchange(other.size_, 0);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Slicing
+
+    // `count` elements starting at `offset`, or everything after `offset`.
+    SharedSpan Subspan(size_t offset, size_t count = kNpos) const& {
+        SharedSpan result = *this;
+        result.Narrow(offset, count);
+        return result;
+    }
+
+    SharedSpan Subspan(size_t offset, size_t count = kNpos) && {
+        Narrow(offset, count);
+        return std::move(*this);
+    }
+
+    SharedSpan First(size_t count) const& {
+        return Subspan(0, count);
+    }
+
+    SharedSpan First(size_t count) && {
+        return std::move(*this).Subspan(0, count);
+    }
+
+    SharedSpan Last(size_t count) const& {
+        CheckBounds(count);
+        return Subspan(size_ - count);
+    }
+
+    SharedSpan Last(size_t count) && {
+        CheckBounds(count);
+        return std::move(*this).Subspan(size_ - count);
+    }
+
+    // `[0, offset)` and `[offset, Size())`.
+    std::pair<SharedSpan, SharedSpan> Split(size_t offset) const& {
+        return {Subspan(0, offset), Subspan(offset)};
+    }
+
+    std::pair<SharedSpan, SharedSpan> Split(size_t offset) && {
+        SharedSpan head = Subspan(0, offset);
+        return {std::move(head), std::move(*this).Subspan(offset)};
+    }
+
+    // Whether `next` starts right where this span ends, in the same buffer.
+    bool IsFollowedBy(const SharedSpan& next) const {
+        return data_.GetBlock() == next.data_.GetBlock() && Data() + size_ == next.Data();
+    }
+
+    // Joins two adjacent spans of one buffer, e.g. the halves of a `Split`, into one.
+    SharedSpan Concat(const SharedSpan& next) const& {
+        SharedSpan result = *this;
+        result.Extend(next);
+        return result;
+    }
+
+    SharedSpan Concat(const SharedSpan& next) && {
+        Extend(next);
+        return std::move(*this);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    T* Data() const {
+        return data_.Get();
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+
+    size_t SizeBytes() const {
+        return size_ * sizeof(T);
+    }
+
+    bool Empty() const {
+        return size_ == 0;
+    }
+
+    T& operator[](size_t index) const {
+        return Data()[index];
+    }
+
+    T* begin() const {
+        return Data();
+    }
+
+    T* end() const {
+        return Data() + size_;
+    }
+
+    std::span<T> AsSpan() const {
+        return {Data(), size_};
+    }
+
+    // How many pointers share the buffer.
+    size_t UseCount() const {
+        return data_.UseCount();
+    }
+
+    const SharedPtr<T>& Owner() const {
+        return data_;
+    }
+
+private:
+    void CheckBounds(size_t count) const {
+        CheckBounds(count, size_);
+    }
+
+    static void CheckBounds(size_t count, size_t limit) {
+        if (count > limit) {
+            throw std::out_of_range("SharedSpan: slice out of range");
+        }
+    }
+
+    void Narrow(size_t offset, size_t count) {
+        CheckBounds(offset);
+        if (count == kNpos) {
+            count = size_ - offset;
+        }
+        // Not `offset + count`, which may wrap around.
+        CheckBounds(count, size_ - offset);
+        data_.GetField() += offset;
+        size_ = count;
+    }
+
+    void Extend(const SharedSpan& next) {
+        if (next.Empty()) {
+            return;
+        }
+        if (Empty() && !data_.GetBlock()) {
+            *this = next;
+            return;
+        }
+        if (!IsFollowedBy(next)) {
+            throw std::invalid_argument("SharedSpan: spans are not adjacent");
+        }
+        size_ += next.size_;
+    }
+
+    SharedPtr<T> data_;
+    size_t size_ = 0;
+};
+
+template <typename T>
+struct IsTriviallyRelocatable<SharedSpan<T>> : std::true_type {};
+
+// Logical concatenation of spans from any buffers, without copying elements. Appending a span that
+// continues the last one extends it instead of adding a piece, so a message reassembled from
+// adjacent slices stays a single contiguous span.
+template <typename T>
+class SharedSpanChain {
+public:
+    SharedSpanChain() = default;
+
+    explicit SharedSpanChain(SharedSpan<T> span) {
+        Append(std::move(span));
+    }
+
+    void Append(SharedSpan<T> span) {
+        if (span.Empty()) {
+            return;
+        }
+        size_ += span.Size();
+        if (!pieces_.Empty() && pieces_[pieces_.Size() - 1].IsFollowedBy(span)) {
+            SharedSpan<T>& last = pieces_[pieces_.Size() - 1];
+            last = std::move(last).Concat(span);
+        } else {
+            pieces_.PushBack(std::move(span));
+        }
+    }
+
+    void Append(const SharedSpanChain& other) {
+        for (const SharedSpan<T>& span : other.pieces_) {
+            Append(span);
+        }
+    }
+
+    // Total number of elements.
+    size_t Size() const {
+        return size_;
+    }
+
+    bool Empty() const {
+        return size_ == 0;
+    }
+
+    size_t PieceCount() const {
+        return pieces_.Size();
+    }
+
+    const SharedSpan<T>& Piece(size_t index) const {
+        return pieces_[index];
+    }
+
+    // Linear in the number of pieces.
+    T& operator[](size_t index) const {
+        for (const SharedSpan<T>& span : pieces_) {
+            if (index < span.Size()) {
+                return span[index];
+            }
+            index -= span.Size();
+        }
+        throw std::out_of_range("SharedSpanChain: index out of range");
+    }
+
+    const SharedSpan<T>* begin() const {
+        return pieces_.begin();
+    }
+
+    const SharedSpan<T>* end() const {
+        return pieces_.end();
+    }
+
+private:
+    RelocatingVector<SharedSpan<T>> pieces_;
+    size_t size_ = 0;
+};
@@ -0,0 +1,149 @@
+#include "shared_span.h"
+
+#include <catch.hpp>
+
+#include "allocations_checker.h"
+
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+SharedSpan<char> Receive(std::string_view bytes) {
+    auto buffer = MakeSharedForOverwrite<char[]>(bytes.size());
+    std::memcpy(buffer.Get(), bytes.data(), bytes.size());
+    return {buffer, bytes.size()};
+}
+
+std::string ToString(const SharedSpan<char>& span) {
+    return {span.begin(), span.end()};
+}
+
+std::string ToString(const SharedSpanChain<char>& chain) {
+    std::string result;
+    for (const SharedSpan<char>& span : chain) {
+        result += ToString(span);
+    }
+    return result;
+}
+
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Empty") {
+    SharedSpan<int> span;
+    REQUIRE(span.Empty());
+    REQUIRE(span.Data() == nullptr);
+    REQUIRE(span.UseCount() == 0);
+    REQUIRE(span.Subspan(0).Empty());
+}
+
+TEST_CASE("Subspan") {
+    auto buffer = MakeShared<int[]>(10);
+    for (int i = 0; i < 10; ++i) {
+        buffer[i] = i;
+    }
+    SharedSpan<int> span(buffer, 10);
+    REQUIRE(span.Size() == 10);
+    REQUIRE(span.UseCount() == 2);
+
+    auto middle = span.Subspan(3, 4);
+    REQUIRE(middle.Data() == buffer.Get() + 3);
+    REQUIRE(middle.Size() == 4);
+    REQUIRE(middle[0] == 3);
+    REQUIRE(middle.Subspan(1).First(2).Last(1)[0] == 5);
+    REQUIRE(span.Subspan(10).Empty());
+    REQUIRE_THROWS_AS(span.Subspan(11), std::out_of_range);
+    REQUIRE_THROWS_AS(span.Subspan(5, 6), std::out_of_range);
+    REQUIRE_THROWS_AS(span.Subspan(1, SIZE_MAX - 1), std::out_of_range);
+    REQUIRE_THROWS_AS(SharedSpan<int>(span).Subspan(2, SIZE_MAX - 1), std::out_of_range);
+
+    SECTION("No allocations") {
+        EXPECT_ZERO_ALLOCATIONS(auto copy = span.Subspan(1, 2));
+        EXPECT_ZERO_ALLOCATIONS(auto halves = span.Split(5));
+    }
+
+    SECTION("Slicing a temporary keeps the count") {
+        size_t use_count = span.UseCount();
+        SharedSpan<int> rest = std::move(span).Subspan(2);
+        REQUIRE(span.Empty());
+        REQUIRE(rest.UseCount() == use_count);
+        rest = std::move(rest).Subspan(2);
+        REQUIRE(rest.UseCount() == use_count);
+        REQUIRE(rest[0] == 4);
+    }
+
+    SECTION("Const view") {
+        SharedSpan<const int> view = span.Subspan(8);
+        REQUIRE(view.Size() == 2);
+        REQUIRE(view[1] == 9);
+    }
+}
+
+TEST_CASE("Records outlive the buffer") {
+    std::vector<SharedSpan<char>> records;
+    {
+        SharedSpan<char> rest = Receive("alpha;beta;gamma");
+        while (!rest.Empty()) {
+            auto end = std::find(rest.begin(), rest.end(), ';') - rest.begin();
+            auto [record, tail] = std::move(rest).Split(end);
+            records.push_back(std::move(record));
+            rest = tail.Empty() ? std::move(tail) : std::move(tail).Subspan(1);
+        }
+    }
+    REQUIRE(records.size() == 3);
+    REQUIRE(ToString(records[0]) == "alpha");
+    REQUIRE(ToString(records[1]) == "beta");
+    REQUIRE(ToString(records[2]) == "gamma");
+    REQUIRE(records[0].UseCount() == 3);
+    records.erase(records.begin(), records.begin() + 2);
+    REQUIRE(records[0].UseCount() == 1);
+}
+
+TEST_CASE("Concat") {
+    SharedSpan<char> message = Receive("header|body");
+    auto [header, body] = message.Split(7);
+    REQUIRE(header.IsFollowedBy(body));
+    REQUIRE(!body.IsFollowedBy(header));
+
+    auto joined = header.Concat(body);
+    REQUIRE(joined.Data() == message.Data());
+    REQUIRE(ToString(joined) == "header|body");
+    REQUIRE(ToString(SharedSpan<char>().Concat(body)) == "body");
+    REQUIRE(ToString(header.Concat(SharedSpan<char>())) == "header|");
+
+    SharedSpan<char> other = Receive("body");
+    REQUIRE(!header.IsFollowedBy(other));
+    REQUIRE_THROWS_AS(header.Concat(other), std::invalid_argument);
+    REQUIRE_THROWS_AS(body.Concat(header), std::invalid_argument);
+}
+
+TEST_CASE("Chains") {
+    SharedSpan<char> first = Receive("Hello, ");
+    SharedSpan<char> second = Receive("world!");
+
+    SharedSpanChain<char> chain;
+    chain.Append(first.First(3));
+    chain.Append(first.Subspan(3));
+    REQUIRE(chain.PieceCount() == 1);
+    chain.Append(SharedSpan<char>());
+    chain.Append(second);
+    REQUIRE(chain.PieceCount() == 2);
+    REQUIRE(chain.Size() == 13);
+    REQUIRE(ToString(chain) == "Hello, world!");
+    REQUIRE(chain[7] == 'w');
+    REQUIRE_THROWS_AS(chain[13], std::out_of_range);
+    REQUIRE(chain.Piece(1).Data() == second.Data());
+
+    SharedSpanChain<char> copy;
+    copy.Append(chain);
+    copy.Append(second.Subspan(0, 5));
+    REQUIRE(copy.PieceCount() == 3);
+    REQUIRE(ToString(copy) == "Hello, world!world");
+    REQUIRE(second.UseCount() == 4);
+}
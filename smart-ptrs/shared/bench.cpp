@@ -0,0 +1,57 @@
+#include "shared.h"
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+constexpr int kIterations = 50'000'000;
+
+template <class F>
+void Measure(const char* name, F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    std::printf("%-40s %6.2f ns/op\n", name, static_cast<double>(ns) / kIterations);
+}
+
+template <class Policy>
+void Copy(const SharedPtr<int, Policy>& ptr) {
+    for (int i = 0; i < kIterations; ++i) {
+        SharedPtr<int, Policy> copy = ptr;
+        asm volatile("" : : "r"(copy.Get()) : "memory");
+    }
+}
+
+template <class Policy>
+void Reset(const SharedPtr<int, Policy>& ptr) {
+    SharedPtr<int, Policy> copy;
+    for (int i = 0; i < kIterations; ++i) {
+        copy = ptr;
+        asm volatile("" : : "r"(copy.Get()) : "memory");
+        copy.Reset();
+    }
+}
+
+void Run(const char* mode) {
+    std::printf("%s (IsSingleThreaded() == %d)\n", mode, IsSingleThreaded());
+
+    auto ptr = MakeShared<int>(42);
+    Measure("  copy + destroy", [&] { Copy(ptr); });
+    Measure("  assign + Reset", [&] { Reset(ptr); });
+
+    SharedPtr<int, SingleThreadedPolicy> local(new int(42));
+    Measure("  copy + destroy (SingleThreadedPolicy)", [&] { Copy(local); });
+    Measure("  assign + Reset (SingleThreadedPolicy)", [&] { Reset(local); });
+}
+
+int main() {
+    Run("Before the first thread");
+
+    // glibc never goes back to single-threaded mode once a thread was started.
+    std::thread([] {}).join();
+
+    Run("After the first thread");
+}
@@ -0,0 +1,67 @@
+#include "shared.h"
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Every thread creates and destroys `SharedPtr`s with separate control blocks, so all of them hit
+// the control block pool at once. The baseline allocates the object and a block of the same size
+// with plain `new`.
+
+constexpr int kIterations = 10'000'000;
+constexpr int kBatch = 16;
+
+struct Payload {
+    alignas(ControlBlock<int>) unsigned char bytes[sizeof(ControlBlock<int>)];
+};
+
+template <class F>
+void Measure(const char* name, int threads, F f) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i) {
+        workers.emplace_back(f);
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    std::printf("%-32s %2d threads %6.2f ns/op\n", name, threads,
+                static_cast<double>(ns) / kIterations);
+}
+
+// Keeps a few blocks alive, so that frees and allocations interleave like in real code.
+void ControlBlocks() {
+    SharedPtr<int> ptrs[kBatch];
+    for (int i = 0; i < kIterations; ++i) {
+        ptrs[i % kBatch] = SharedPtr<int>(new int(i));
+        asm volatile("" : : "r"(ptrs[i % kBatch].Get()) : "memory");
+    }
+}
+
+void NewDelete() {
+    int* objects[kBatch] = {};
+    Payload* blocks[kBatch] = {};
+    for (int i = 0; i < kIterations; ++i) {
+        delete objects[i % kBatch];
+        delete blocks[i % kBatch];
+        objects[i % kBatch] = new int(i);
+        blocks[i % kBatch] = new Payload();
+        asm volatile("" : : "r"(blocks[i % kBatch]) : "memory");
+    }
+    for (int i = 0; i < kBatch; ++i) {
+        delete objects[i];
+        delete blocks[i];
+    }
+}
+
+int main() {
+    for (int threads : {1, 2, 4, 8}) {
+        Measure("SharedPtr(new int)", threads, ControlBlocks);
+        Measure("  new int + new block", threads, NewDelete);
+    }
+}
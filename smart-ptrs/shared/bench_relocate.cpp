@@ -0,0 +1,49 @@
+#include "shared.h"
+
+#include <common/relocating_vector.h>
+#include <intrusive/intrusive.h>
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+constexpr size_t kElements = 10'000'000;
+
+template <class F>
+void Measure(const char* name, F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+    std::printf("%-50s %6lld ms\n", name, static_cast<long long>(ms));
+}
+
+// Grows the vector one element at a time, so every reallocation relocates everything so far.
+template <class Vector, class Ptr>
+void Grow(const Ptr& ptr) {
+    Vector vector;
+    for (size_t i = 0; i < kElements; ++i) {
+        if constexpr (requires { vector.push_back(ptr); }) {
+            vector.push_back(ptr);
+        } else {
+            vector.PushBack(ptr);
+        }
+    }
+}
+
+struct Node : SimpleRefCounted<Node> {};
+
+int main() {
+    auto shared = MakeShared<int>(42);
+    Measure("std::vector<SharedPtr<int>>", [&] { Grow<std::vector<SharedPtr<int>>>(shared); });
+    Measure("RelocatingVector<SharedPtr<int>>",
+            [&] { Grow<RelocatingVector<SharedPtr<int>>>(shared); });
+
+    auto intrusive = MakeIntrusive<Node>();
+    Measure("std::vector<IntrusivePtr<Node>>",
+            [&] { Grow<std::vector<IntrusivePtr<Node>>>(intrusive); });
+    Measure("RelocatingVector<IntrusivePtr<Node>>",
+            [&] { Grow<RelocatingVector<IntrusivePtr<Node>>>(intrusive); });
+}
@@ -1,11 +1,630 @@
 #pragma once
 
+#include <common/biased_counter.h>
+#include <common/deferred_release.h>
+#include <common/magazine.h>
+#include <common/relocatable.h>
+#include <common/single_threaded.h>
+#include <common/slab_pool.h>
+#include <unique/compressed_pair.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <exception>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Counter policies. The policy only decides *how* the counter word stored in `BaseBlock` is
+// updated, so blocks created through either policy have exactly the same layout.
+
+// Plain loads and stores, for pointers that never leave their thread.
+struct SingleThreadedPolicy {
+    static void Add(std::atomic<uint64_t>& word, uint64_t delta) {
+        word.store(word.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    // Returns the previous value.
+    static uint64_t Sub(std::atomic<uint64_t>& word, uint64_t delta) {
+        uint64_t value = word.load(std::memory_order_relaxed);
+        word.store(value - delta, std::memory_order_relaxed);
+        return value;
+    }
+
+    static bool CompareExchange(std::atomic<uint64_t>& word, uint64_t& expected,
+                                uint64_t desired) {
+        uint64_t value = word.load(std::memory_order_relaxed);
+        if (value != expected) {
+            expected = value;
+            return false;
+        }
+        word.store(desired, std::memory_order_relaxed);
+        return true;
+    }
+};
+
+// Relaxed increments, acq_rel decrements: safe to share between threads. Until the process starts
+// its first thread it falls back to the single-threaded updates.
+struct AtomicPolicy {
+    static void Add(std::atomic<uint64_t>& word, uint64_t delta) {
+        if (IsSingleThreaded()) {
+            SingleThreadedPolicy::Add(word, delta);
+            return;
+        }
+        word.fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    static uint64_t Sub(std::atomic<uint64_t>& word, uint64_t delta) {
+        if (IsSingleThreaded()) {
+            return SingleThreadedPolicy::Sub(word, delta);
+        }
+        return word.fetch_sub(delta, std::memory_order_acq_rel);
+    }
+
+    static bool CompareExchange(std::atomic<uint64_t>& word, uint64_t& expected,
+                                uint64_t desired) {
+        if (IsSingleThreaded()) {
+            return SingleThreadedPolicy::CompareExchange(word, expected, desired);
+        }
+        return word.compare_exchange_weak(expected, desired, std::memory_order_relaxed);
+    }
+};
+
+using DefaultPolicy = AtomicPolicy;
+
+class BaseBlock;
+
+// Type-erased part of a control block. It is only consulted once a counter drops to zero, so the
+// increment/decrement fast path never makes an indirect call.
+struct BlockOps {
+    void (*destroy_object)(BaseBlock* block);
+    void (*deallocate)(BaseBlock* block);
+    // Only set by blocks that hold a deleter; `tag` is `&kTypeTag<Deleter>`.
+    void* (*get_deleter)(BaseBlock* block, const void* tag) = nullptr;
+};
+
+// One address per type, to recognise a deleter type without RTTI.
+template <class T>
+inline constexpr char kTypeTag = 0;
+
+// Both counters live in one 64-bit word: the strong count in the low half, the weak count in the
+// high half. All strong references together hold one extra weak reference, so the block dies
+// exactly when the weak half reaches zero, and the last strong release sees from a single RMW
+// whether anybody else still observes the block.
+//
+// Biased blocks keep their strong count in a `BiasedCounter` instead and only carry a flag in the
+// strong half; the flag never changes, so checking it is a plain load.
+//
+// Immortal blocks carry another flag, set once by `MakeImmortal` and never cleared. Every counter
+// update checks the flags first and leaves an immortal block alone, so copies of a global
+// singleton never write to its cache line. The object is never destroyed. A thread that missed the
+// flag still updates the counter as usual, which is harmless: the reference held by whoever made
+// the block immortal is never released, so the count cannot reach zero.
+class BaseBlock {
+public:
+    explicit BaseBlock(const BlockOps* ops, bool biased = false)
+        : counters_(kWeakRef | (biased ? kBiased : 0)), ops_(ops) {
+    }
+
+    template <class Policy>
+    void AddStrongRef(uint64_t count = 1) {
+        if (HasFlags()) [[unlikely]] {
+            if (IsImmortal()) {
+                return;
+            }
+            while (count--) {
+                AddBiasedStrongRef();
+            }
+            return;
+        }
+        Policy::Add(counters_, count * kStrongRef);
+    }
+
+    template <class Policy>
+    bool AddStrongRefIfNonZero() {
+        uint64_t value = counters_.load(std::memory_order_relaxed);
+        while (true) {
+            if (value & kFlags) [[unlikely]] {
+                return (value & kImmortal) || AddBiasedStrongRefIfNonZero();
+            }
+            if (!(value & kStrongMask)) {
+                return false;
+            }
+            if (Policy::CompareExchange(counters_, value, value + kStrongRef)) {
+                return true;
+            }
+        }
+    }
+
+    // Drops `count` strong references at once.
+    template <class Policy>
+    void DecStrongRef(uint64_t count = 1) {
+        if (HasFlags()) [[unlikely]] {
+            if (IsImmortal()) {
+                return;
+            }
+            while (count--) {
+                if (DecBiasedStrongRef()) {
+                    ReleaseObject();
+                }
+            }
+            return;
+        }
+        uint64_t previous = Policy::Sub(counters_, count * kStrongRef);
+        if ((previous & kStrongMask) != count * kStrongRef) [[likely]] {
+            return;
+        }
+        ops_->destroy_object(this);
+        if (previous == count * kStrongRef + kWeakRef) {
+            // Nobody but us could reach the block, so the weak reference need not be released.
+            ops_->deallocate(this);
+        } else {
+            DecWeakRef<Policy>();
+        }
+    }
+
+    template <class Policy>
+    void AddWeakRef() {
+        if (IsImmortal()) [[unlikely]] {
+            return;
+        }
+        Policy::Add(counters_, kWeakRef);
+    }
+
+    template <class Policy>
+    void DecWeakRef() {
+        if (IsImmortal()) [[unlikely]] {
+            return;
+        }
+        if ((Policy::Sub(counters_, kWeakRef) & kWeakMask) == kWeakRef) [[unlikely]] {
+            ops_->deallocate(this);
+        }
+    }
+
+    // The caller must hold a strong reference; it is never released.
+    void MakeImmortal() {
+        counters_.fetch_or(kImmortal, std::memory_order_relaxed);
+    }
+
+    bool IsImmortal() const {
+        return counters_.load(std::memory_order_relaxed) & kImmortal;
+    }
+
+    int GetCount() const {
+        if (IsBiased()) [[unlikely]] {
+            return BiasedCount();
+        }
+        return static_cast<int>(counters_.load(std::memory_order_relaxed) & kStrongMask);
+    }
+
+    bool IsEmpty() const {
+        return (GetCount() == 0);
+    }
+
+    // Whether the caller's strong reference is the only reference of any kind, apart from
+    // `self_weak` weak references that the object keeps to itself. Acquires the releases of the
+    // others, so the object may be modified right away.
+    bool IsUnique(uint64_t self_weak = 0) const {
+        uint64_t expected = (self_weak + 1) * kWeakRef + kStrongRef;
+        return counters_.load(std::memory_order_acquire) == expected;
+    }
+
+    int WeakCount() const {
+        uint64_t value = counters_.load(std::memory_order_relaxed);
+        return static_cast<int>(value >> 32) - (IsEmpty() ? 0 : 1);
+    }
+
+    // The deleter of type `Deleter` stored in the block, or nullptr.
+    template <class Deleter>
+    Deleter* GetDeleter() {
+        if (!ops_->get_deleter) {
+            return nullptr;
+        }
+        return static_cast<Deleter*>(ops_->get_deleter(this, &kTypeTag<Deleter>));
+    }
+
+protected:
+    ~BaseBlock() = default;
+
+    // The strong count reached zero.
+    void ReleaseObject() {
+        ops_->destroy_object(this);
+        DecWeakRef<AtomicPolicy>();
+    }
+
+private:
+    static constexpr uint64_t kStrongRef = 1;
+    static constexpr uint64_t kBiased = uint64_t{1} << 31;
+    static constexpr uint64_t kImmortal = uint64_t{1} << 30;
+    static constexpr uint64_t kFlags = kBiased | kImmortal;
+    static constexpr uint64_t kStrongMask = kImmortal - 1;
+    static constexpr uint64_t kWeakRef = uint64_t{1} << 32;
+    static constexpr uint64_t kWeakMask = ~(kWeakRef - 1);
+
+    bool IsBiased() const {
+        return counters_.load(std::memory_order_relaxed) & kBiased;
+    }
+
+    bool HasFlags() const {
+        return counters_.load(std::memory_order_relaxed) & kFlags;
+    }
+
+    // Defined after `BiasedBaseBlock`.
+    void AddBiasedStrongRef();
+    bool AddBiasedStrongRefIfNonZero();
+    bool DecBiasedStrongRef();
+    int BiasedCount() const;
+
+    std::atomic<uint64_t> counters_ = kWeakRef;
+    const BlockOps* ops_;
+};
+
+// Every `ControlBlock<T>` has the same size, so they all come from one slab pool instead of
+// `malloc`.
+using ControlBlockPool = SlabPool<sizeof(BaseBlock) + sizeof(void*), alignof(BaseBlock)>;
+
+template <class T>
+class ControlBlock : public BaseBlock {
+public:
+    ControlBlock(T* ptr) : BaseBlock(&kOps), ptr_(ptr) {
+    }
+
+    ~ControlBlock() = default;
+
+    static void* operator new(size_t) {
+        static_assert(sizeof(ControlBlock) == sizeof(BaseBlock) + sizeof(void*));
+        return ControlBlockPool::Instance().Allocate();
+    }
+
+    static void operator delete(void* ptr) {
+        ControlBlockPool::Instance().Free(ptr);
+    }
+
+private:
+    static void DestroyObject(BaseBlock* block) {
+        auto self = static_cast<ControlBlock*>(block);
+        delete self->ptr_;
+        self->ptr_ = nullptr;
+    }
+
+    static void Deallocate(BaseBlock* block) {
+        delete static_cast<ControlBlock*>(block);
+    }
+
+    static constexpr BlockOps kOps{&DestroyObject, &Deallocate};
+
+    T* ptr_;
+};
+
+// Releases the memory of control blocks that are no longer in use.
+inline size_t TrimControlBlockPool() {
+    return ControlBlockPool::Instance().Trim();
+}
+
+// `MakeShared` embeds objects up to this size into the control block. Larger ones get their own
+// allocation, so the memory goes back as soon as the object dies rather than with the last
+// `WeakPtr`.
+inline constexpr size_t kSplitStorageThreshold = 4096;
+
+// Selects default- rather than value-initialization of the object in the block.
+struct ForOverwrite {};
+
+template <class T>
+class Block : public BaseBlock {
+public:
+    template <typename... Args>
+    Block(Args&&... args) : BaseBlock(&kOps) {
+        ::new (&storage_) T(std::forward<Args>(args)...);
+    }
+
+    explicit Block(ForOverwrite) : BaseBlock(&kOps) {
+        ::new (&storage_) T;
+    }
+
+    T* GetPtr() {
+        return reinterpret_cast<T*>(&storage_);
+    }
+
+    ~Block() = default;
+
+private:
+    static void DestroyObject(BaseBlock* block) {
+        static_cast<Block*>(block)->GetPtr()->~T();
+    }
+
+    static void Deallocate(BaseBlock* block) {
+        delete static_cast<Block*>(block);
+    }
+
+    static constexpr BlockOps kOps{&DestroyObject, &Deallocate};
+
+    std::aligned_storage_t<sizeof(T), alignof(T)> storage_;
+};
+
+// Control block of `MakeShared<T[]>` and `MakeShared<T[N]>`: the elements follow the block in the
+// same allocation and are destroyed one by one, last to first.
+template <class T>
+class ArrayBlock : public BaseBlock {
+public:
+    static ArrayBlock* Create(size_t size) {
+        return Construct(size, [](T* element) { ::new (element) T(); });
+    }
+
+    static ArrayBlock* Create(size_t size, ForOverwrite) {
+        return Construct(size, [](T* element) { ::new (element) T; });
+    }
+
+    T* GetPtr() {
+        return reinterpret_cast<T*>(reinterpret_cast<char*>(this) + Offset());
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+
+private:
+    explicit ArrayBlock(size_t size) : BaseBlock(&kOps), size_(size) {
+    }
+
+    ~ArrayBlock() = default;
+
+    template <class Init>
+    static ArrayBlock* Construct(size_t size, Init init) {
+        void* memory = Allocate(size);
+        auto block = new (memory) ArrayBlock(size);
+        T* elements = block->GetPtr();
+        size_t constructed = 0;
+        try {
+            for (; constructed < size; ++constructed) {
+                init(elements + constructed);
+            }
+        } catch (...) {
+            DestroyRange(elements, constructed);
+            Free(memory);
+            throw;
+        }
+        return block;
+    }
+
+    static constexpr size_t Offset() {
+        return (sizeof(ArrayBlock) + alignof(T) - 1) / alignof(T) * alignof(T);
+    }
+
+    static constexpr bool OverAligned() {
+        return alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+    }
+
+    static void* Allocate(size_t size) {
+        if (size > (SIZE_MAX - Offset()) / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        size_t bytes = Offset() + size * sizeof(T);
+        if constexpr (OverAligned()) {
+            return ::operator new(bytes, std::align_val_t{alignof(T)});
+        } else {
+            return ::operator new(bytes);
+        }
+    }
+
+    static void Free(void* memory) {
+        if constexpr (OverAligned()) {
+            ::operator delete(memory, std::align_val_t{alignof(T)});
+        } else {
+            ::operator delete(memory);
+        }
+    }
+
+    static void DestroyRange(T* elements, size_t count) {
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            while (count) {
+                elements[--count].~T();
+            }
+        }
+    }
+
+    static void DestroyObject(BaseBlock* block) {
+        auto self = static_cast<ArrayBlock*>(block);
+        DestroyRange(self->GetPtr(), self->size_);
+    }
+
+    static void Deallocate(BaseBlock* block) {
+        auto self = static_cast<ArrayBlock*>(block);
+        self->~ArrayBlock();
+        Free(self);
+    }
+
+    static constexpr BlockOps kOps{&DestroyObject, &Deallocate};
+
+    size_t size_;
+};
+
+// Control block of `MakeBiasedShared`: references taken on the creating thread are counted
+// without atomics, see common/biased_counter.h.
+class BiasedBaseBlock : public BaseBlock, public BiasedCounter {
+protected:
+    explicit BiasedBaseBlock(const BlockOps* ops) : BaseBlock(ops, true), BiasedCounter(&OnZero) {
+    }
+
+    ~BiasedBaseBlock() = default;
+
+private:
+    static void OnZero(BiasedCounter* counter) {
+        static_cast<BiasedBaseBlock*>(counter)->ReleaseObject();
+    }
+};
+
+inline void BaseBlock::AddBiasedStrongRef() {
+    static_cast<BiasedBaseBlock*>(this)->Increment();
+}
+
+inline bool BaseBlock::AddBiasedStrongRefIfNonZero() {
+    return static_cast<BiasedBaseBlock*>(this)->IncrementIfNonZero();
+}
+
+inline bool BaseBlock::DecBiasedStrongRef() {
+    return static_cast<BiasedBaseBlock*>(this)->Decrement();
+}
+
+inline int BaseBlock::BiasedCount() const {
+    return static_cast<const BiasedBaseBlock*>(this)->UseCount();
+}
+
+template <class T>
+class BiasedBlock : public BiasedBaseBlock {
+public:
+    template <typename... Args>
+    BiasedBlock(Args&&... args) : BiasedBaseBlock(&kOps) {
+        ::new (&storage_) T(std::forward<Args>(args)...);
+    }
+
+    T* GetPtr() {
+        return reinterpret_cast<T*>(&storage_);
+    }
+
+    ~BiasedBlock() = default;
+
+private:
+    static void DestroyObject(BaseBlock* block) {
+        static_cast<BiasedBlock*>(block)->GetPtr()->~T();
+    }
+
+    static void Deallocate(BaseBlock* block) {
+        delete static_cast<BiasedBlock*>(block);
+    }
+
+    static constexpr BlockOps kOps{&DestroyObject, &Deallocate};
+
+    std::aligned_storage_t<sizeof(T), alignof(T)> storage_;
+};
+
+// Control block of `AllocateShared`: block, object and allocator share one allocation taken from
+// the allocator itself. The allocator sits in a `CompressedPair`, so an empty one costs nothing.
+template <class T, class Alloc>
+class AllocatedBlock : public BaseBlock {
+public:
+    using BlockAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<AllocatedBlock>;
+
+    template <typename... Args>
+    static AllocatedBlock* Create(const Alloc& alloc, Args&&... args) {
+        BlockAlloc block_alloc(alloc);
+        auto block = std::allocator_traits<BlockAlloc>::allocate(block_alloc, 1);
+        try {
+            return new (block) AllocatedBlock(block_alloc, std::forward<Args>(args)...);
+        } catch (...) {
+            std::allocator_traits<BlockAlloc>::deallocate(block_alloc, block, 1);
+            throw;
+        }
+    }
+
+    T* GetPtr() {
+        return reinterpret_cast<T*>(&pair_.GetSecond());
+    }
+
+private:
+    template <typename... Args>
+    AllocatedBlock(const BlockAlloc& alloc, Args&&... args) : BaseBlock(&kOps), pair_(alloc) {
+        ::new (GetPtr()) T(std::forward<Args>(args)...);
+    }
+
+    ~AllocatedBlock() = default;
+
+    static void DestroyObject(BaseBlock* block) {
+        static_cast<AllocatedBlock*>(block)->GetPtr()->~T();
+    }
+
+    static void Deallocate(BaseBlock* block) {
+        auto self = static_cast<AllocatedBlock*>(block);
+        BlockAlloc alloc(std::move(self->pair_.GetFirst()));
+        self->~AllocatedBlock();
+        std::allocator_traits<BlockAlloc>::deallocate(alloc, self, 1);
+    }
+
+    static constexpr BlockOps kOps{&DestroyObject, &Deallocate};
+
+    CompressedPair<BlockAlloc, std::aligned_storage_t<sizeof(T), alignof(T)>> pair_;
+};
+
+// Control block for a pointer that is released by `deleter` rather than `delete`, allocated
+// through `Alloc`. Empty deleters and allocators are folded into the pointer, so the block is no
+// larger than `ControlBlock<T>`.
+template <class T, class Deleter, class Alloc>
+class DeleterBlock : public BaseBlock {
+public:
+    using BlockAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<DeleterBlock>;
+
+    static DeleterBlock* Create(T* ptr, Deleter deleter, const Alloc& alloc) {
+        BlockAlloc block_alloc(alloc);
+        DeleterBlock* block;
+        try {
+            block = std::allocator_traits<BlockAlloc>::allocate(block_alloc, 1);
+        } catch (...) {
+            deleter(ptr);
+            throw;
+        }
+        return new (block) DeleterBlock(ptr, std::move(deleter), block_alloc);
+    }
+
+    Deleter& GetDeleter() {
+        return pair_.GetFirst().GetFirst();
+    }
+
+private:
+    DeleterBlock(T* ptr, Deleter&& deleter, const BlockAlloc& alloc)
+        : BaseBlock(&kOps), pair_(Extras(std::move(deleter), alloc), ptr) {
+    }
+
+    ~DeleterBlock() = default;
+
+    static void DestroyObject(BaseBlock* block) {
+        auto self = static_cast<DeleterBlock*>(block);
+        self->GetDeleter()(self->pair_.GetSecond());
+        self->pair_.GetSecond() = nullptr;
+    }
+
+    static void Deallocate(BaseBlock* block) {
+        auto self = static_cast<DeleterBlock*>(block);
+        BlockAlloc alloc(std::move(self->pair_.GetFirst().GetSecond()));
+        self->~DeleterBlock();
+        std::allocator_traits<BlockAlloc>::deallocate(alloc, self, 1);
+    }
+
+    static void* FindDeleter(BaseBlock* block, const void* tag) {
+        if (tag != &kTypeTag<Deleter>) {
+            return nullptr;
+        }
+        return &static_cast<DeleterBlock*>(block)->GetDeleter();
+    }
+
+    static constexpr BlockOps kOps{&DestroyObject, &Deallocate, &FindDeleter};
+
+    using Extras = CompressedPair<Deleter, BlockAlloc>;
+
+    CompressedPair<Extras, T*> pair_;
+};
 
 class BadWeakPtr : public std::exception {};
 
-template <typename T>
+// Thrown when a `LocalSharedPtr` that is not the sole reference is promoted.
+class BadPromotion : public std::exception {};
+
+template <typename T, typename Policy = DefaultPolicy>
 class SharedPtr;
 
-template <typename T>
+template <typename T, typename Policy = DefaultPolicy>
 class WeakPtr;
+
+// Thread-confined pointers: the same blocks with plain counter updates. They never convert into the
+// thread-safe pointers implicitly; `SharedPtr<T>(std::move(local))` promotes the sole reference.
+template <typename T>
+using LocalSharedPtr = SharedPtr<T, SingleThreadedPolicy>;
+
+template <typename T>
+using LocalWeakPtr = WeakPtr<T, SingleThreadedPolicy>;
+
+template <typename T, typename Policy>
+struct IsTriviallyRelocatable<SharedPtr<T, Policy>> : std::true_type {};
+
+template <typename T, typename Policy>
+struct IsTriviallyRelocatable<WeakPtr<T, Policy>> : std::true_type {};
@@ -4,7 +4,13 @@
 
 #include "allocations_checker.h"
 
+#include <common/my_int.h>
+#include <common/relocating_vector.h>
+
+#include <atomic>
 #include <memory>
+#include <thread>
+#include <vector>
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -455,3 +461,683 @@ TEST_CASE("Destructor for correct type") {
         REQUIRE(B::destructor_called);
     }
 }
+
+TEST_CASE("Counter policies") {
+    SECTION("Single-threaded") {
+        B::destructor_called = false;
+        {
+            SharedPtr<A, SingleThreadedPolicy> a(new B());
+            SharedPtr<A, SingleThreadedPolicy> b = a;
+            REQUIRE(a.UseCount() == 2);
+            b.Reset();
+            REQUIRE(a.UseCount() == 1);
+        }
+        REQUIRE(B::destructor_called);
+
+        static_assert(!std::is_convertible_v<SharedPtr<int, SingleThreadedPolicy>, SharedPtr<int>>);
+        static_assert(!std::is_convertible_v<SharedPtr<int>, SharedPtr<int, SingleThreadedPolicy>>);
+    }
+
+    SECTION("Copies from many threads") {
+        constexpr int kThreads = 8;
+        constexpr int kIterations = 10000;
+
+        Data::data_was_deleted = false;
+        {
+            auto shared = MakeShared<Data>(42, 3.14);
+            std::vector<std::thread> threads;
+            for (int i = 0; i < kThreads; ++i) {
+                threads.emplace_back([shared] {
+                    for (int j = 0; j < kIterations; ++j) {
+                        SharedPtr<Data> copy = shared;
+                        SharedPtr<double> alias(copy, &copy->y);
+                        copy.Reset();
+                    }
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+            REQUIRE(shared.UseCount() == 1);
+            REQUIRE(!Data::data_was_deleted);
+        }
+        REQUIRE(Data::data_was_deleted);
+    }
+}
+
+TEST_CASE("Control blocks") {
+    static_assert(!std::is_polymorphic_v<BaseBlock>);
+    static_assert(!std::is_polymorphic_v<ControlBlock<Base>>);
+    static_assert(!std::is_polymorphic_v<Block<Base>>);
+    static_assert(sizeof(ControlBlock<int>) == 2 * sizeof(void*) + sizeof(uint64_t));
+
+    Derived::i_was_deleted = false;
+    {
+        SharedPtr<Base> base = MakeShared<Derived>();
+        SharedPtr<Base> copy = base;
+    }
+    REQUIRE(Derived::i_was_deleted);
+}
+
+TEST_CASE("Biased reference counting") {
+    SECTION("Owner thread") {
+        Derived::i_was_deleted = false;
+        {
+            SharedPtr<Base> base = MakeBiasedShared<Derived>();
+            SharedPtr<Base> copy = base;
+            REQUIRE(base.UseCount() == 2);
+            copy.Reset();
+            REQUIRE(base.UseCount() == 1);
+        }
+        REQUIRE(Derived::i_was_deleted);
+    }
+
+    SECTION("Copies released on other threads") {
+        constexpr int kThreads = 8;
+        constexpr int kIterations = 10000;
+
+        Data::data_was_deleted = false;
+        auto shared = MakeBiasedShared<Data>(42, 3.14);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kThreads; ++i) {
+            threads.emplace_back([copy = shared]() mutable {
+                for (int j = 0; j < kIterations; ++j) {
+                    SharedPtr<Data> other = copy;
+                }
+                copy.Reset();
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(!Data::data_was_deleted);
+        shared.Reset();
+        REQUIRE(Data::data_was_deleted);
+    }
+
+    SECTION("Owner thread exits first") {
+        Data::data_was_deleted = false;
+        SharedPtr<Data> shared;
+        std::thread([&shared] {
+            auto local = MakeBiasedShared<Data>(42, 3.14);
+            shared = local;
+        }).join();
+        REQUIRE(shared.UseCount() == 1);
+        REQUIRE(!Data::data_was_deleted);
+        shared.Reset();
+        REQUIRE(Data::data_was_deleted);
+    }
+}
+
+TEST_CASE("Deferred releases") {
+    SECTION("Destroyed at the end of the scope") {
+        Derived::i_was_deleted = false;
+        {
+            DeferredReleaseScope scope;
+            SharedPtr<Base> base = MakeShared<Derived>();
+            for (int i = 0; i < 100; ++i) {
+                SharedPtr<Base> copy = base;
+            }
+            REQUIRE(base.UseCount() == 101);
+            base.Reset();
+            REQUIRE(!Derived::i_was_deleted);
+        }
+        REQUIRE(Derived::i_was_deleted);
+    }
+
+    SECTION("Flush") {
+        DeferredReleaseScope scope;
+        SharedPtr<int> a(new int(1));
+        SharedPtr<int> b = MakeShared<int>(2);
+        {
+            SharedPtr<int> a_copy = a;
+            SharedPtr<int> b_copy = b;
+        }
+        REQUIRE(a.UseCount() == 2);
+        REQUIRE(b.UseCount() == 2);
+        FlushDeferredReleases();
+        REQUIRE(a.UseCount() == 1);
+        REQUIRE(b.UseCount() == 1);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Bump allocator over a fixed buffer, the way a per-request arena hands out memory.
+struct Arena {
+    alignas(std::max_align_t) char buffer[1024];
+    size_t used = 0;
+    int allocations = 0;
+    int deallocations = 0;
+};
+
+template <class T>
+struct ArenaAllocator {
+    using value_type = T;
+
+    explicit ArenaAllocator(Arena* arena) : arena(arena) {
+    }
+
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {
+    }
+
+    T* allocate(size_t n) {
+        constexpr size_t kAlign = alignof(std::max_align_t);
+        auto ptr = reinterpret_cast<T*>(arena->buffer + arena->used);
+        arena->used += (n * sizeof(T) + kAlign - 1) / kAlign * kAlign;
+        ++arena->allocations;
+        return ptr;
+    }
+
+    void deallocate(T*, size_t) {
+        ++arena->deallocations;
+    }
+
+    Arena* arena;
+};
+
+struct CountingDeleter {
+    void operator()(int* ptr) {
+        ++calls;
+        delete ptr;
+    }
+
+    static inline int calls = 0;
+};
+
+TEST_CASE("Allocators") {
+    static_assert(sizeof(AllocatedBlock<int, std::allocator<int>>) == sizeof(Block<int>));
+    static_assert(sizeof(DeleterBlock<int, CountingDeleter, std::allocator<int>>) ==
+                  sizeof(ControlBlock<int>));
+
+    SECTION("AllocateShared") {
+        Arena arena;
+        Data::data_was_deleted = false;
+        EXPECT_ZERO_ALLOCATIONS({
+            SharedPtr<Data> data = AllocateShared<Data>(ArenaAllocator<Data>(&arena), 42, 3.14);
+            REQUIRE(data->x == 42);
+            SharedPtr<Data> copy = data;
+            REQUIRE(copy.UseCount() == 2);
+        });
+        REQUIRE(Data::data_was_deleted);
+        REQUIRE(arena.allocations == 1);
+        REQUIRE(arena.deallocations == 1);
+    }
+
+    SECTION("Deleter and allocator") {
+        Arena arena;
+        CountingDeleter::calls = 0;
+        auto ptr = new int(42);
+        EXPECT_ZERO_ALLOCATIONS({
+            SharedPtr<int> a(ptr, CountingDeleter(), ArenaAllocator<char>(&arena));
+            REQUIRE(*a == 42);
+            SharedPtr<int> b = a;
+        });
+        REQUIRE(CountingDeleter::calls == 1);
+        REQUIRE(arena.allocations == 1);
+        REQUIRE(arena.deallocations == 1);
+    }
+}
+
+struct Element {
+    Element() : value(42) {
+        ++alive;
+    }
+
+    ~Element() {
+        --alive;
+        destroyed.push_back(this);
+    }
+
+    int value;
+
+    static inline int alive = 0;
+    static inline std::vector<const Element*> destroyed;
+};
+
+TEST_CASE("Arrays") {
+    SECTION("Unbounded") {
+        EXPECT_ONE_ALLOCATION({
+            SharedPtr<int[]> a = MakeShared<int[]>(100);
+            for (int i = 0; i < 100; ++i) {
+                REQUIRE(a[i] == 0);
+            }
+        });
+
+        SharedPtr<int[]> a = MakeShared<int[]>(5);
+        SharedPtr<int[]> b = a;
+        b[4] = 7;
+        REQUIRE(a[4] == 7);
+        REQUIRE(a.UseCount() == 2);
+
+        auto empty = MakeShared<Element[]>(0);
+        REQUIRE(empty.UseCount() == 1);
+    }
+
+    SECTION("Too many elements") {
+        REQUIRE_THROWS_AS(MakeShared<int[]>(SIZE_MAX / 2), std::bad_array_new_length);
+        REQUIRE_THROWS_AS(MakeSharedForOverwrite<double[]>(SIZE_MAX / 8 + 1),
+                          std::bad_array_new_length);
+        REQUIRE_THROWS_AS(MakeShared<Element[]>(SIZE_MAX), std::bad_array_new_length);
+        REQUIRE(Element::alive == 0);
+    }
+
+    SECTION("Raw arrays") {
+        {
+            SharedPtr<MyInt[]> a(new MyInt[3]);
+            REQUIRE(MyInt::AliveCount() == 3);
+            a.Reset(new MyInt[2]);
+            REQUIRE(MyInt::AliveCount() == 2);
+        }
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Bounded") {
+        EXPECT_ONE_ALLOCATION(MakeShared<double[16]>());
+
+        SharedPtr<double[16]> a = MakeShared<double[16]>();
+        a[15] = 1.5;
+        REQUIRE(a.Get()[15] == 1.5);
+    }
+
+    SECTION("Element-wise destruction") {
+        Element::destroyed.clear();
+        {
+            SharedPtr<Element[]> a = MakeShared<Element[]>(3);
+            REQUIRE(Element::alive == 3);
+            REQUIRE(a[2].value == 42);
+            a.Reset();
+            REQUIRE(Element::alive == 0);
+        }
+        REQUIRE(Element::destroyed.size() == 3);
+        REQUIRE(Element::destroyed[0] > Element::destroyed[2]);
+    }
+
+    SECTION("Over-aligned elements") {
+        struct alignas(64) Line {
+            char bytes[64];
+        };
+        SharedPtr<Line[]> a = MakeShared<Line[]>(4);
+        REQUIRE(reinterpret_cast<uintptr_t>(a.Get()) % 64 == 0);
+    }
+}
+
+TEST_CASE("For-overwrite factories") {
+    EXPECT_ONE_ALLOCATION(MakeSharedForOverwrite<int>());
+    EXPECT_ONE_ALLOCATION(MakeSharedForOverwrite<char[]>(1 << 20));
+    EXPECT_ONE_ALLOCATION(MakeSharedForOverwrite<char[4096]>());
+
+    SharedPtr<char[]> buffer = MakeSharedForOverwrite<char[]>(1 << 20);
+    buffer[(1 << 20) - 1] = 'x';
+    REQUIRE(buffer[(1 << 20) - 1] == 'x');
+
+    // Class types are still constructed.
+    {
+        SharedPtr<Element[]> elements = MakeSharedForOverwrite<Element[]>(4);
+        REQUIRE(Element::alive == 4);
+        REQUIRE(elements[3].value == 42);
+        SharedPtr<Element> element = MakeSharedForOverwrite<Element>();
+        REQUIRE(element->value == 42);
+    }
+    REQUIRE(Element::alive == 0);
+}
+
+TEST_CASE("Custom deleters") {
+    SECTION("Stateless") {
+        CountingDeleter::calls = 0;
+        {
+            SharedPtr<int> a(new int(1), CountingDeleter());
+            SharedPtr<int> b = a;
+            REQUIRE(a.GetDeleter<CountingDeleter>() != nullptr);
+            REQUIRE(a.GetDeleter<std::default_delete<int>>() == nullptr);
+        }
+        REQUIRE(CountingDeleter::calls == 1);
+    }
+
+    SECTION("Stateful") {
+        int released = -1;
+        auto release = [&released](int* ptr) {
+            released = *ptr;
+            delete ptr;
+        };
+        {
+            SharedPtr<int> a(new int(5), release);
+            REQUIRE(a.GetDeleter<decltype(release)>() != nullptr);
+            a.Reset(new int(6), release);
+            REQUIRE(released == 5);
+        }
+        REQUIRE(released == 6);
+    }
+
+    SECTION("No deleter") {
+        SharedPtr<int> a(new int(1));
+        REQUIRE(a.GetDeleter<CountingDeleter>() == nullptr);
+        SharedPtr<int> empty;
+        REQUIRE(empty.GetDeleter<CountingDeleter>() == nullptr);
+        REQUIRE(MakeShared<int>(1).GetDeleter<CountingDeleter>() == nullptr);
+    }
+
+    SECTION("Upcast") {
+        Derived::i_was_deleted = false;
+        int calls = 0;
+        {
+            SharedPtr<Base> base(new Derived(), [&calls](Derived* ptr) {
+                ++calls;
+                delete ptr;
+            });
+        }
+        REQUIRE(calls == 1);
+        REQUIRE(Derived::i_was_deleted);
+    }
+}
+
+TEST_CASE("Control block pool") {
+    SECTION("Blocks are reused") {
+        SharedPtr<int> warm(new int(0));
+        int* first = new int(1);
+        int* second = new int(2);
+        EXPECT_ZERO_ALLOCATIONS({
+            SharedPtr<int> a(first);
+            SharedPtr<int> b = a;
+            a.Reset(second);
+            REQUIRE(*a == 2);
+            REQUIRE(*b == 1);
+        });
+    }
+
+    SECTION("Trim") {
+        auto& pool = ControlBlockPool::Instance();
+        TrimControlBlockPool();
+        size_t slabs = pool.SlabCount();
+        {
+            std::vector<SharedPtr<int>> ptrs;
+            for (int i = 0; i < 10000; ++i) {
+                ptrs.emplace_back(new int(i));
+            }
+            REQUIRE(pool.SlabCount() > slabs);
+        }
+        REQUIRE(TrimControlBlockPool() > 0);
+        REQUIRE(pool.SlabCount() == slabs);
+    }
+
+    SECTION("Thread caches") {
+        constexpr int kThreads = 4;
+        constexpr int kCount = 5000;
+
+        auto& pool = ControlBlockPool::Instance();
+        TrimControlBlockPool();
+        size_t slabs = pool.SlabCount();
+        std::vector<std::vector<SharedPtr<int>>> batches(kThreads);
+        std::atomic<int> wrong_values = 0;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kThreads; ++i) {
+            threads.emplace_back([&batches, &wrong_values, i] {
+                for (int j = 0; j < kCount; ++j) {
+                    batches[i].emplace_back(new int(j));
+                    if (j % 3 == 0) {
+                        batches[i].pop_back();
+                    }
+                }
+                for (int j = 0; j < kCount; ++j) {
+                    SharedPtr<int> ptr(new int(j));
+                    wrong_values += *ptr != j;
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        // Blocks allocated by the threads are freed here, and the caches of the exited threads
+        // went back to the pool.
+        batches.clear();
+        REQUIRE(wrong_values == 0);
+        TrimControlBlockPool();
+        REQUIRE(pool.SlabCount() == slabs);
+    }
+}
+
+TEST_CASE("Magazines") {
+    constexpr int kCount = 1000;
+
+    SECTION("Reused on the same thread") {
+        MakePooledShared<Data>(0, 0.0);
+        EXPECT_ZERO_ALLOCATIONS({
+            for (int i = 0; i < kCount; ++i) {
+                auto data = MakePooledShared<Data>(i, 0.5);
+                REQUIRE(data->x == i);
+            }
+        });
+    }
+
+    SECTION("Released on another thread") {
+        std::vector<SharedPtr<Data>> ptrs;
+        ptrs.reserve(kCount);
+        for (int i = 0; i < kCount; ++i) {
+            ptrs.push_back(MakePooledShared<Data>(i, 0.5));
+        }
+        std::thread([&ptrs] { ptrs.clear(); }).join();
+
+        // The remote frees come back through the queue instead of new pages.
+        EXPECT_ZERO_ALLOCATIONS({
+            for (int i = 0; i < kCount; ++i) {
+                ptrs.push_back(MakePooledShared<Data>(i, 0.5));
+            }
+        });
+    }
+
+    SECTION("Allocated after thread exit") {
+        // Constructed before the thread's heap, so destroyed after the heap is parked.
+        struct Late {
+            ~Late() {
+                MakePooledShared<Data>(1, 0.5);
+            }
+        };
+
+        size_t parked = ThreadHeap::ParkedCount();
+        std::thread([] {
+            [[maybe_unused]] static thread_local Late late;
+            MakePooledShared<Data>(0, 0.0);
+        }).join();
+        // The borrowed heap went back to the parked list.
+        REQUIRE(ThreadHeap::ParkedCount() == std::max<size_t>(parked, 1));
+    }
+
+    SECTION("Producers and consumers") {
+        constexpr int kThreads = 4;
+        struct Payload {
+            int x;
+            double y;
+        };
+
+        std::vector<std::vector<SharedPtr<Payload>>> batches(kThreads);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kThreads; ++i) {
+            threads.emplace_back([&batches, i] {
+                for (int j = 0; j < kCount; ++j) {
+                    batches[i].push_back(MakePooledShared<Payload>(j, 0.5));
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        threads.clear();
+        std::atomic<int> wrong_values = 0;
+        for (int i = 0; i < kThreads; ++i) {
+            threads.emplace_back([&batches, &wrong_values, i] {
+                auto& batch = batches[(i + 1) % kThreads];
+                for (int j = 0; j < kCount; ++j) {
+                    wrong_values += batch[j]->x != j;
+                }
+                batch.clear();
+                for (int j = 0; j < kCount; ++j) {
+                    batch.push_back(MakePooledShared<Payload>(j, 0.5));
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(wrong_values == 0);
+    }
+}
+
+// Copied by `RelocatingVector` since it has no noexcept move; the copies can be made to fail.
+struct Fragile {
+    explicit Fragile(int value) : value(value) {
+        ++alive;
+    }
+
+    Fragile(const Fragile& other) : value(other.value) {
+        if (copies_left-- == 0) {
+            throw std::runtime_error("copy failed");
+        }
+        ++alive;
+    }
+
+    ~Fragile() {
+        --alive;
+    }
+
+    int value;
+    static inline int alive = 0;
+    static inline int copies_left = 1000;
+};
+
+TEST_CASE("Relocation") {
+    static_assert(std::is_nothrow_move_constructible_v<SharedPtr<int>>);
+    static_assert(std::is_nothrow_move_assignable_v<SharedPtr<int>>);
+    static_assert(kIsTriviallyRelocatable<SharedPtr<int>>);
+    static_assert(kIsTriviallyRelocatable<SharedPtr<int[], SingleThreadedPolicy>>);
+    static_assert(!kIsTriviallyRelocatable<std::vector<int>>);
+
+    auto shared = MakeShared<int>(42);
+    {
+        RelocatingVector<SharedPtr<int>> ptrs;
+        for (int i = 0; i < 10000; ++i) {
+            ptrs.PushBack(shared);
+        }
+        ptrs.PushBack(ptrs[0]);
+        REQUIRE(ptrs.Size() == 10001);
+        REQUIRE(shared.UseCount() == 10002);
+        for (const auto& ptr : ptrs) {
+            REQUIRE(*ptr == 42);
+        }
+        ptrs.PopBack();
+        REQUIRE(shared.UseCount() == 10001);
+    }
+    REQUIRE(shared.UseCount() == 1);
+
+    // Elements that are not trivially relocatable are moved one by one.
+    RelocatingVector<std::vector<int>> vectors;
+    for (int i = 0; i < 100; ++i) {
+        vectors.EmplaceBack(3, i);
+    }
+    REQUIRE(vectors[99] == std::vector<int>{99, 99, 99});
+
+    // A failed copy leaves the elements as they were.
+    {
+        RelocatingVector<Fragile> fragile;
+        for (int i = 0; i < 8; ++i) {
+            fragile.EmplaceBack(i);
+        }
+        Fragile::copies_left = 4;
+        REQUIRE_THROWS_AS(fragile.EmplaceBack(8), std::runtime_error);
+        REQUIRE(fragile.Size() == 8);
+        REQUIRE(fragile.Capacity() == 8);
+        REQUIRE(Fragile::alive == 8);
+        for (int i = 0; i < 8; ++i) {
+            REQUIRE(fragile[i].value == i);
+        }
+        Fragile::copies_left = 100;
+        fragile.EmplaceBack(8);
+        REQUIRE(fragile[8].value == 8);
+    }
+    REQUIRE(Fragile::alive == 0);
+
+    // Sizes that do not fit in `size_t` bytes are rejected instead of wrapping around.
+    RelocatingVector<SharedPtr<int>> empty;
+    REQUIRE_THROWS_AS(empty.Reserve(SIZE_MAX / 2), std::length_error);
+    REQUIRE_THROWS_AS(vectors.Reserve(SIZE_MAX / 8), std::length_error);
+    REQUIRE(vectors.Size() == 100);
+}
+
+TEST_CASE("Local pointers") {
+    static_assert(std::is_same_v<LocalSharedPtr<int>, SharedPtr<int, SingleThreadedPolicy>>);
+    static_assert(!std::is_convertible_v<LocalSharedPtr<int>, SharedPtr<int>>);
+    static_assert(!std::is_convertible_v<LocalSharedPtr<int>&&, SharedPtr<int>>);
+    static_assert(std::is_constructible_v<SharedPtr<int>, LocalSharedPtr<int>&&>);
+    static_assert(!std::is_constructible_v<SharedPtr<int>, const LocalSharedPtr<int>&>);
+    static_assert(!std::is_constructible_v<LocalSharedPtr<int>, SharedPtr<int>&&>);
+
+    SECTION("Shard-local copies") {
+        Derived::i_was_deleted = false;
+        {
+            LocalSharedPtr<Derived> local = MakeLocalShared<Derived>();
+            LocalSharedPtr<Base> base = local;
+            REQUIRE(base.UseCount() == 2);
+        }
+        REQUIRE(Derived::i_was_deleted);
+        EXPECT_ONE_ALLOCATION(MakeLocalShared<int>(1));
+    }
+
+    SECTION("Promotion") {
+        LocalSharedPtr<int> local = MakeLocalShared<int>(5);
+        SharedPtr<int> shared(std::move(local));
+        REQUIRE(!local);
+        REQUIRE(*shared == 5);
+        REQUIRE(shared.UseCount() == 1);
+
+        int value = 0;
+        std::thread([copy = shared, &value] { value = *copy; }).join();
+        REQUIRE(value == 5);
+        REQUIRE(shared.UseCount() == 1);
+    }
+
+    SECTION("Promotion of a shared reference") {
+        LocalSharedPtr<int> local = MakeLocalShared<int>(5);
+        LocalSharedPtr<int> copy = local;
+        REQUIRE_THROWS_AS(SharedPtr<int>(std::move(local)), BadPromotion);
+        REQUIRE(local.UseCount() == 2);
+        copy.Reset();
+        SharedPtr<int> shared(std::move(local));
+        REQUIRE(*shared == 5);
+    }
+}
+
+TEST_CASE("Immortal objects") {
+    // Immortal objects are never freed; the pointer keeps them reachable for the leak checker.
+    static auto* immortal = new SharedPtr<std::vector<int>>(
+        MakeImmortal(MakeShared<std::vector<int>>(std::vector<int>{1, 2, 3})));
+    REQUIRE(immortal->GetBlock()->IsImmortal());
+    REQUIRE(immortal->UseCount() == 2);
+    REQUIRE(MakeImmortal(SharedPtr<int>()).Get() == nullptr);
+
+    SECTION("Copies don't count") {
+        std::vector<SharedPtr<std::vector<int>>> copies(100, *immortal);
+        REQUIRE(immortal->UseCount() == 2);
+        copies.clear();
+        REQUIRE((**immortal)[2] == 3);
+    }
+
+    SECTION("Threads") {
+        std::atomic<int> wrong_values = 0;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 4; ++i) {
+            threads.emplace_back([&wrong_values] {
+                for (int j = 0; j < 1000; ++j) {
+                    SharedPtr<std::vector<int>> copy = *immortal;
+                    if (copy->size() != 3) {
+                        ++wrong_values;
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(wrong_values == 0);
+        REQUIRE(immortal->UseCount() == 2);
+    }
+}
@@ -14,6 +14,9 @@ class CompressedPair<F, S, true, true, true> : F, S {
 public:
     CompressedPair(){};
 
+    // The second element is default-initialized.
+    explicit CompressedPair(const F& first) : F(first){};
+
     CompressedPair(const F& first, const S& second) : F(first), S(second){};
 
     CompressedPair(const F& first, S&& second) : F(first), S(std::move(second)){};
@@ -44,6 +47,8 @@ class CompressedPair<F, S, true, true, false> : F {
 public:
     CompressedPair() : second_(){};
 
+    explicit CompressedPair(const F& first) : F(first){};
+
     CompressedPair(const F& first, const S& second) : F(first), second_(second){};
 
     CompressedPair(const F& first, S&& second) : F(first), second_(std::move(second)){};
@@ -77,6 +82,8 @@ class CompressedPair<F, S, true, false, true> : F {
 public:
     CompressedPair() : second_(){};
 
+    explicit CompressedPair(const F& first) : F(first){};
+
     CompressedPair(const F& first, const S& second) : F(first), second_(second){};
 
     CompressedPair(const F& first, S&& second) : F(first), second_(std::move(second)){};
@@ -110,6 +117,8 @@ class CompressedPair<F, S, true, false, false> : F {
 public:
     CompressedPair() : second_(){};
 
+    explicit CompressedPair(const F& first) : F(first){};
+
     CompressedPair(const F& first, const S& second) : F(first), second_(second){};
 
     CompressedPair(const F& first, S&& second) : F(first), second_(std::move(second)){};
@@ -143,6 +152,8 @@ class CompressedPair<F, S, false, true, true> : S {
 public:
     CompressedPair() : first_(){};
 
+    explicit CompressedPair(const F& first) : first_(first){};
+
     CompressedPair(const F& first, const S& second) : first_(first), S(second){};
 
     CompressedPair(const F& first, S&& second) : first_(first), S(std::move(second)){};
@@ -176,6 +187,8 @@ class CompressedPair<F, S, false, true, false> : S {
 public:
     CompressedPair() : first_(){};
 
+    explicit CompressedPair(const F& first) : first_(first){};
+
     CompressedPair(const F& first, const S& second) : first_(first), S(second){};
 
     CompressedPair(const F& first, S&& second) : first_(first), S(std::move(second)){};
@@ -209,6 +222,8 @@ class CompressedPair<F, S, false, false, true> {
 public:
     CompressedPair() : first_(), second_(){};
 
+    explicit CompressedPair(const F& first) : first_(first){};
+
     CompressedPair(const F& first, const S& second) : first_(first), second_(second){};
 
     CompressedPair(const F& first, S&& second) : first_(first), second_(std::move(second)){};
@@ -243,6 +258,8 @@ class CompressedPair<F, S, false, false, false> {
 public:
     CompressedPair() : first_(), second_(){};
 
+    explicit CompressedPair(const F& first) : first_(first){};
+
     CompressedPair(const F& first, const S& second) : first_(first), second_(second){};
 
     CompressedPair(const F& first, S&& second) : first_(first), second_(std::move(second)){};
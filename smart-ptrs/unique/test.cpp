@@ -504,3 +504,31 @@ TEST_CASE("Upcasts") {
         s2 = std::move(s);
     }
 }
+
+TEST_CASE("For-overwrite factories") {
+    SECTION("Scalar") {
+        UniquePtr<MyInt> u = MakeUniqueForOverwrite<MyInt>();
+        REQUIRE(MyInt::AliveCount() == 1);
+        u.Reset();
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Array") {
+        UniquePtr<int[]> buffer = MakeUniqueForOverwrite<int[]>(1024);
+        for (size_t i = 0; i < 1024; ++i) {
+            buffer[i] = i;
+        }
+        REQUIRE(buffer[1023] == 1023);
+
+        UniquePtr<MyInt[]> objects = MakeUniqueForOverwrite<MyInt[]>(10);
+        REQUIRE(MyInt::AliveCount() == 10);
+        objects.Reset();
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+}
+
+TEST_CASE("Relocation") {
+    static_assert(kIsTriviallyRelocatable<UniquePtr<int>>);
+    static_assert(kIsTriviallyRelocatable<UniquePtr<int[]>>);
+    static_assert(std::is_nothrow_move_constructible_v<UniquePtr<int>>);
+}
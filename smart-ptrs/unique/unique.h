@@ -2,7 +2,10 @@
 
 #include "compressed_pair.h"
 
+#include <common/relocatable.h>
+
 #include <cstddef>  // std::nullptr_t
+#include <type_traits>
 
 template <class T>
 struct Slug {
@@ -279,3 +282,25 @@ public:
 private:
     CompressedPair<T*, Deleter> pair_;
 };
+
+template <typename T, typename Deleter>
+struct IsTriviallyRelocatable<UniquePtr<T, Deleter>>
+    : std::bool_constant<kIsTriviallyRelocatable<Deleter>> {};
+
+// Default-initializing factories: trivially constructible objects (and elements) are left
+// uninitialized, for buffers that are about to be overwritten anyway.
+template <typename T>
+    requires(!std::is_array_v<T>)
+UniquePtr<T> MakeUniqueForOverwrite() {
+    return UniquePtr<T>(new T);
+}
+
+template <typename T>
+    requires std::is_unbounded_array_v<T>
+UniquePtr<T> MakeUniqueForOverwrite(size_t size) {
+    return UniquePtr<T>(new std::remove_extent_t<T>[size]);
+}
+
+template <typename T, typename... Args>
+    requires std::is_bounded_array_v<T>
+void MakeUniqueForOverwrite(Args&&...) = delete;
@@ -0,0 +1,197 @@
+#include "weak_cache.h"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// A file that is removed at the end of the test.
+class TempFile {
+public:
+    explicit TempFile(const std::string& name)
+        : path_(std::filesystem::temp_directory_path() /
+                (name + "." + std::to_string(::getpid()))) {
+    }
+
+    ~TempFile() {
+        std::filesystem::remove(path_);
+    }
+
+    void Write(const std::string& contents) const {
+        std::ofstream(path_) << contents;
+    }
+
+    std::string Path() const {
+        return path_.string();
+    }
+
+private:
+    std::filesystem::path path_;
+};
+
+constexpr const char* kCalmPsi =
+    "some avg10=0.00 avg60=0.00 avg300=0.00 total=0\n"
+    "full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n";
+constexpr const char* kStalledPsi =
+    "some avg10=42.50 avg60=10.00 avg300=1.00 total=123456\n"
+    "full avg10=20.00 avg60=5.00 avg300=0.50 total=65432\n";
+
+MemoryPressure NoPressure() {
+    return MemoryPressure("/nonexistent/psi", "/nonexistent/meminfo");
+}
+
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Memory pressure") {
+    TempFile psi("psi");
+    TempFile meminfo("meminfo");
+
+    psi.Write(kCalmPsi);
+    REQUIRE(MemoryPressure::ReadStallPercent(psi.Path()) == 0.0);
+    REQUIRE(!MemoryPressure(psi.Path(), meminfo.Path()).IsHigh());
+    psi.Write(kStalledPsi);
+    REQUIRE(MemoryPressure::ReadStallPercent(psi.Path()) == 42.5);
+    REQUIRE(MemoryPressure(psi.Path(), meminfo.Path()).IsHigh());
+    REQUIRE(!MemoryPressure(psi.Path(), meminfo.Path(), 50.0).IsHigh());
+
+    // Without PSI the available memory decides.
+    meminfo.Write("MemTotal:       16000000 kB\nMemFree:          100000 kB\n"
+                  "MemAvailable:    1000000 kB\nBuffers:          200000 kB\n");
+    REQUIRE(MemoryPressure::ReadAvailableFraction(meminfo.Path()) == 1.0 / 16);
+    REQUIRE(MemoryPressure("/nonexistent/psi", meminfo.Path()).IsHigh());
+    REQUIRE(!MemoryPressure("/nonexistent/psi", meminfo.Path(), 10.0, 0.05).IsHigh());
+    REQUIRE(!NoPressure().IsHigh());
+}
+
+TEST_CASE("Hits while the value is alive") {
+    WeakCache<std::string, std::string> cache(0, NoPressure());
+    REQUIRE(!cache.Get("key"));
+
+    auto value = MakeShared<std::string>("decoded");
+    cache.Put("key", value);
+    REQUIRE(cache.Get("key") == value);
+    REQUIRE(value.UseCount() == 1);
+
+    value.Reset();
+    REQUIRE(!cache.Get("key"));
+    REQUIRE(cache.Size() == 0);
+
+    int made = 0;
+    auto make = [&] {
+        ++made;
+        return MakeShared<std::string>("made");
+    };
+    auto first = cache.GetOrCreate("other", make);
+    auto second = cache.GetOrCreate("other", make);
+    REQUIRE(first == second);
+    REQUIRE(made == 1);
+}
+
+TEST_CASE("Pins") {
+    WeakCache<int, int> cache(2, NoPressure());
+    for (int i = 0; i < 3; ++i) {
+        cache.Put(i, MakeShared<int>(i));
+    }
+    REQUIRE(cache.PinnedCount() == 2);
+    // The least recently used value was unpinned and died.
+    REQUIRE(!cache.Get(0));
+    REQUIRE(*cache.Get(1) == 1);
+    cache.Put(3, MakeShared<int>(3));
+    REQUIRE(*cache.Get(1) == 1);
+    REQUIRE(!cache.Get(2));
+
+    auto held = cache.Get(3);
+    REQUIRE(cache.ReleasePins() == 2);
+    REQUIRE(!cache.Get(1));
+    REQUIRE(cache.Get(3) == held);
+
+    cache.Erase(3);
+    REQUIRE(!cache.Get(3));
+    REQUIRE(held.UseCount() == 1);
+}
+
+TEST_CASE("Pressure drops the pins") {
+    TempFile psi("psi");
+    psi.Write(kCalmPsi);
+    WeakCache<int, int> cache(16, MemoryPressure(psi.Path(), "/nonexistent/meminfo"));
+    for (int i = 0; i < 16; ++i) {
+        cache.Put(i, MakeShared<int>(i));
+    }
+    REQUIRE(!cache.CheckPressure());
+    REQUIRE(cache.PinnedCount() == 16);
+
+    psi.Write(kStalledPsi);
+    SECTION("On request") {
+        REQUIRE(cache.CheckPressure());
+    }
+    SECTION("Periodically") {
+        for (size_t i = 0; i < WeakCache<int, int>::kPressureCheckInterval; ++i) {
+            cache.Get(-1);
+        }
+    }
+    REQUIRE(cache.PinnedCount() == 0);
+    REQUIRE(!cache.Get(5));
+}
+
+TEST_CASE("Incremental sweep") {
+    WeakCache<int, int> cache(0, NoPressure());
+    constexpr int kEntries = 1000;
+    std::vector<SharedPtr<int>> values;
+    for (int i = 0; i < kEntries; ++i) {
+        values.push_back(MakeShared<int>(i));
+        cache.Put(i, values.back());
+    }
+    for (int i = 0; i < kEntries; ++i) {
+        if (i % 10) {
+            values[i].Reset();
+        }
+    }
+    // A single operation sweeps a few buckets only.
+    cache.Get(-1);
+    REQUIRE(cache.Size() > kEntries / 2);
+    for (int i = 0; i < kEntries; ++i) {
+        cache.Get(-1);
+    }
+    REQUIRE(cache.Size() == kEntries / 10);
+    REQUIRE(*cache.Get(500) == 500);
+}
+
+TEST_CASE("Concurrent users") {
+    constexpr int kThreads = 4;
+    constexpr int kKeys = 64;
+
+    WeakCache<int, std::string> cache(8, NoPressure());
+    std::atomic<int> wrong = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < 2000; ++i) {
+                int key = (i * 7 + t) % kKeys;
+                auto value = cache.GetOrCreate(
+                    key, [key] { return MakeShared<std::string>(std::to_string(key)); });
+                if (*value != std::to_string(key)) {
+                    ++wrong;
+                }
+                if (i % 100 == 0) {
+                    cache.ReleasePins();
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    REQUIRE(wrong == 0);
+}
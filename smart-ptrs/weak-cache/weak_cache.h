@@ -0,0 +1,227 @@
+#pragma once
+
+#include <shared-from-this/shared.h>
+#include <shared-from-this/weak.h>
+
+#include <common/memory_pressure.h>
+#include <common/single_threaded.h>
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Cache of objects that are alive anyway: it maps keys to `WeakPtr`s, so a lookup hits while
+// somebody still holds the value and never keeps it alive by itself.
+//
+// On top of that the cache pins the `pinned_capacity` most recently used values with strong
+// references, so that an object survives short gaps between its users. The pins are dropped all
+// at once when `MemoryPressure` reports that the system is short of memory; the cache checks it
+// every `kPressureCheckInterval` operations, or on `CheckPressure`. The check reads files, so it
+// runs outside of the lock, on the thread whose operation made it due.
+//
+// Entries whose values have died are swept incrementally: every operation inspects the next
+// `kSweepBuckets` buckets of the table, so the cost of the cleanup is spread over the lookups
+// instead of paid in one scan. One mutex guards the cache, skipped while the process is
+// single-threaded; values are released outside of it.
+template <typename K, typename V, typename Hash = std::hash<K>>
+class WeakCache {
+    using PinList = std::list<std::pair<K, SharedPtr<V>>>;
+
+public:
+    static constexpr size_t kSweepBuckets = 2;
+    static constexpr size_t kPressureCheckInterval = 4096;
+
+    explicit WeakCache(size_t pinned_capacity, MemoryPressure pressure = MemoryPressure())
+        : pinned_capacity_(pinned_capacity), pressure_(std::move(pressure)) {
+    }
+
+    WeakCache(const WeakCache&) = delete;
+    WeakCache& operator=(const WeakCache&) = delete;
+
+    // The value of `key` if somebody still holds it, or an empty pointer.
+    SharedPtr<V> Get(const K& key) {
+        PinList dropped;
+        SharedPtr<V> value;
+        bool check_due;
+        {
+            auto lock = Lock();
+            check_due = Maintain();
+            auto it = map_.find(key);
+            if (it != map_.end()) {
+                value = it->second.weak.Lock();
+                if (value) {
+                    Pin(it->first, it->second, value, dropped);
+                } else {
+                    map_.erase(it);
+                }
+            }
+        }
+        if (check_due) {
+            CheckPressure();
+        }
+        return value;
+    }
+
+    // Stores `value` under `key`, replacing the previous one, and pins it.
+    void Put(const K& key, const SharedPtr<V>& value) {
+        PinList dropped;
+        bool check_due;
+        {
+            auto lock = Lock();
+            check_due = Maintain();
+            auto [it, inserted] = map_.try_emplace(key);
+            it->second.weak = value;
+            Pin(it->first, it->second, value, dropped);
+        }
+        if (check_due) {
+            CheckPressure();
+        }
+    }
+
+    // The value of `key`, made by `make()` and stored if nobody holds one. `make` runs without the
+    // lock, so two threads may build the same value; the first one to finish wins.
+    template <class F>
+    SharedPtr<V> GetOrCreate(const K& key, F&& make) {
+        if (SharedPtr<V> value = Get(key)) {
+            return value;
+        }
+        SharedPtr<V> created = make();
+        PinList dropped;
+        auto lock = Lock();
+        auto [it, inserted] = map_.try_emplace(key);
+        if (SharedPtr<V> value = it->second.weak.Lock()) {
+            Pin(it->first, it->second, value, dropped);
+            return value;
+        }
+        it->second.weak = created;
+        Pin(it->first, it->second, created, dropped);
+        return created;
+    }
+
+    void Erase(const K& key) {
+        PinList dropped;
+        auto lock = Lock();
+        auto it = map_.find(key);
+        if (it == map_.end()) {
+            return;
+        }
+        if (it->second.pinned) {
+            dropped.splice(dropped.end(), pins_, it->second.pin);
+        }
+        map_.erase(it);
+    }
+
+    // Drops every pin. Returns how many values were pinned.
+    size_t ReleasePins() {
+        PinList pins;
+        {
+            auto lock = Lock();
+            Unpin(pins);
+        }
+        return pins.size();
+    }
+
+    // Drops the pins if the system is short of memory. Returns whether it was. Reads the pressure
+    // without holding the lock.
+    bool CheckPressure() {
+        if (!pressure_.IsHigh()) {
+            return false;
+        }
+        ReleasePins();
+        return true;
+    }
+
+    // Entries, including the expired ones not swept yet.
+    size_t Size() const {
+        auto lock = Lock();
+        return map_.size();
+    }
+
+    size_t PinnedCount() const {
+        auto lock = Lock();
+        return pins_.size();
+    }
+
+private:
+    struct Entry {
+        WeakPtr<V> weak;
+        typename PinList::iterator pin;
+        bool pinned = false;
+    };
+
+    std::unique_lock<std::mutex> Lock() const {
+        std::unique_lock lock(mutex_, std::defer_lock);
+        if (!IsSingleThreaded()) {
+            lock.lock();
+        }
+        return lock;
+    }
+
+    // Moves the entry to the front of the pins. The pin evicted to make room goes to `dropped`, to
+    // be released by the caller after unlocking.
+    void Pin(const K& key, Entry& entry, const SharedPtr<V>& value, PinList& dropped) {
+        if (!pinned_capacity_) {
+            return;
+        }
+        if (entry.pinned) {
+            if (entry.pin->second != value) {
+                dropped.emplace_back(key, std::exchange(entry.pin->second, value));
+            }
+            pins_.splice(pins_.begin(), pins_, entry.pin);
+            return;
+        }
+        if (pins_.size() == pinned_capacity_) {
+            map_.find(pins_.back().first)->second.pinned = false;
+            dropped.splice(dropped.end(), pins_, std::prev(pins_.end()));
+        }
+        pins_.emplace_front(key, value);
+        entry.pin = pins_.begin();
+        entry.pinned = true;
+    }
+
+    // Moves all pins to `dropped`.
+    void Unpin(PinList& dropped) {
+        for (auto& [key, value] : pins_) {
+            map_.find(key)->second.pinned = false;
+        }
+        dropped.splice(dropped.end(), pins_);
+    }
+
+    // Runs on every operation, under the lock. Returns whether the pressure check is due; the
+    // caller runs it after unlocking.
+    bool Maintain() {
+        Sweep();
+        return ++operations_ % kPressureCheckInterval == 0;
+    }
+
+    // Erases the expired entries of the next `kSweepBuckets` buckets.
+    void Sweep() {
+        size_t buckets = map_.bucket_count();
+        for (size_t step = 0; step < kSweepBuckets; ++step) {
+            size_t bucket = sweep_cursor_++ % buckets;
+            expired_.clear();
+            for (auto it = map_.begin(bucket); it != map_.end(bucket); ++it) {
+                if (!it->second.pinned && it->second.weak.Expired()) {
+                    expired_.push_back(it->first);
+                }
+            }
+            for (const K& key : expired_) {
+                map_.erase(key);
+            }
+        }
+    }
+
+    size_t pinned_capacity_;
+    MemoryPressure pressure_;
+    std::unordered_map<K, Entry, Hash> map_;
+    PinList pins_;
+    std::vector<K> expired_;
+    size_t sweep_cursor_ = 0;
+    size_t operations_ = 0;
+    mutable std::mutex mutex_;
+};
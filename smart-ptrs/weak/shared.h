@@ -3,14 +3,19 @@
 #include "sw_fwd.h"  // Forward declaration
 
 #include <cstddef>  // std::nullptr_t
+#include <memory>
+#include <type_traits>
 
 // https://en.cppreference.com/w/cpp/memory/shared_ptr
-template <typename T>
+template <typename T, typename Policy>
 class SharedPtr {
 public:
-    template <class U>
+    template <class U, class P>
     friend class SharedPtr;
 
+    // `U` for `U[]` and `U[N]`.
+    using ElementType = std::remove_extent_t<T>;
+
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Constructors
 
@@ -29,7 +34,19 @@ public:
 
     template <class U>
     explicit SharedPtr(U* ptr) : field_(ptr) {
-        block_ = new ControlBlock<U>(ptr);
+        block_ = NewBlock(ptr);
+        AddStrongRef();
+    }
+
+    // The object is released with `deleter` instead of `delete`; `GetDeleter` gives it back.
+    template <class U, class Deleter>
+    SharedPtr(U* ptr, Deleter deleter) : SharedPtr(ptr, std::move(deleter), std::allocator<U>()) {
+    }
+
+    // The control block is allocated through `alloc` and releases the object with `deleter`.
+    template <class U, class Deleter, class Alloc>
+    SharedPtr(U* ptr, Deleter deleter, const Alloc& alloc) : field_(ptr) {
+        block_ = DeleterBlock<U, Deleter, Alloc>::Create(ptr, std::move(deleter), alloc);
         AddStrongRef();
     }
 
@@ -42,7 +59,7 @@ public:
     };
 
     template <class U>
-    SharedPtr(const SharedPtr<U>& other) {
+    SharedPtr(const SharedPtr<U, Policy>& other) {
         if (field_ != other.field_) {
             block_ = other.block_;
             field_ = other.field_;
@@ -50,7 +67,7 @@ public:
         }
     }
 
-    SharedPtr(SharedPtr&& other) {
+    SharedPtr(SharedPtr&& other) noexcept {
         DecStrongRef();
         block_ = other.block_;
         field_ = other.field_;
@@ -59,7 +76,7 @@ public:
     };
 
     template <class U>
-    SharedPtr(SharedPtr<U>&& other) {
+    SharedPtr(SharedPtr<U, Policy>&& other) noexcept {
         DecStrongRef();
         block_ = other.block_;
         field_ = other.field_;
@@ -67,22 +84,40 @@ public:
         other.field_ = nullptr;
     }
 
+    // Checked promotion of a thread-confined pointer. Other references would keep updating the
+    // counters without atomics, so `local` has to be the only one, weak references included.
+    template <class U>
+        requires(!std::is_same_v<Policy, SingleThreadedPolicy>)
+    explicit SharedPtr(SharedPtr<U, SingleThreadedPolicy>&& local) {
+        if (local.block_ && (local.block_->GetCount() != 1 || local.block_->WeakCount() != 0)) {
+            throw BadPromotion();
+        }
+        block_ = local.block_;
+        field_ = local.field_;
+        local.block_ = nullptr;
+        local.field_ = nullptr;
+    }
+
     void AddStrongRef() {
         if (block_) {
-            block_->AddStrongRef();
+            block_->template AddStrongRef<Policy>();
         }
     }
 
     void DecStrongRef() {
         if (block_) {
-            block_->DecStrongRef();
+            if (DeferredReleases::Active()) [[unlikely]] {
+                DeferredReleases::Push(block_, &ReleaseDeferred);
+                return;
+            }
+            block_->template DecStrongRef<Policy>();
         }
     }
 
     // Aliasing constructor
     // #8 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
     template <typename Y>
-    SharedPtr(const SharedPtr<Y>& other, T* ptr) : field_(ptr) {
+    SharedPtr(const SharedPtr<Y, Policy>& other, ElementType* ptr) : field_(ptr) {
         block_ = other.GetBlock();
         AddStrongRef();
     }
@@ -92,13 +127,12 @@ public:
     }
     // Promote `WeakPtr`
     // #11 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
-    explicit SharedPtr(const WeakPtr<T>& other) {
-        if (other.Expired()) {
+    explicit SharedPtr(const WeakPtr<T, Policy>& other) {
+        if (!other.GetBlock() || !other.GetBlock()->template AddStrongRefIfNonZero<Policy>()) {
             throw BadWeakPtr();
         }
         block_ = other.GetBlock();
         field_ = other.GetField();
-        AddStrongRef();
     };
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -116,7 +150,7 @@ public:
     };
 
     template <class U>
-    SharedPtr& operator=(const SharedPtr<U>& other) {
+    SharedPtr& operator=(const SharedPtr<U, Policy>& other) {
         if (field_ != other.field_) {
             DecStrongRef();
             CLear();
@@ -128,14 +162,11 @@ public:
     }
 
     void CLear() {
-        if (block_ && block_->IsEmpty() && !block_->WeakCount()) {
-            delete block_;
-        }
         block_ = nullptr;
         field_ = nullptr;
     }
 
-    SharedPtr& operator=(SharedPtr&& other) {
+    SharedPtr& operator=(SharedPtr&& other) noexcept {
         DecStrongRef();
         CLear();
         block_ = other.block_;
@@ -146,7 +177,7 @@ public:
     };
 
     template <class U>
-    SharedPtr& operator=(SharedPtr<U>&& other) {
+    SharedPtr& operator=(SharedPtr<U, Policy>&& other) noexcept {
         DecStrongRef();
         CLear();
         block_ = other.block_;
@@ -169,8 +200,6 @@ public:
     void Reset() {
         DecStrongRef();
         CLear();
-        field_ = nullptr;
-        block_ = nullptr;
     };
 
     void Reset(T* ptr) {
@@ -186,11 +215,21 @@ public:
         DecStrongRef();
         CLear();
         field_ = ptr;
-        block_ = new ControlBlock<U>(ptr);
+        block_ = NewBlock(ptr);
+        AddStrongRef();
+    }
+
+    template <class U, class Deleter>
+    void Reset(U* ptr, Deleter deleter) {
+        DecStrongRef();
+        CLear();
+        field_ = ptr;
+        block_ = DeleterBlock<U, Deleter, std::allocator<U>>::Create(ptr, std::move(deleter),
+                                                                    std::allocator<U>());
         AddStrongRef();
     }
 
-    void Swap(SharedPtr& other) {
+    void Swap(SharedPtr& other) noexcept {
         std::swap(block_, other.block_);
         std::swap(field_, other.field_);
     };
@@ -198,18 +237,31 @@ public:
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Observers
 
-    T* Get() const {
+    ElementType* Get() const {
         return field_;
     };
 
-    T& operator*() const {
+    ElementType& operator*() const {
         return *field_;
     };
 
-    T* operator->() const {
+    ElementType* operator->() const {
         return field_;
     };
 
+    ElementType& operator[](ptrdiff_t index) const {
+        return field_[index];
+    }
+
+    // The deleter passed on construction or `Reset`, if it has type `Deleter`.
+    template <class Deleter>
+    Deleter* GetDeleter() const {
+        if (!block_) {
+            return nullptr;
+        }
+        return block_->template GetDeleter<Deleter>();
+    }
+
     size_t UseCount() const {
         if (!block_) {
             return 0;
@@ -221,11 +273,11 @@ public:
         return (field_ != nullptr);
     };
 
-    T*& GetField() {
+    ElementType*& GetField() {
         return field_;
     }
 
-    T* GetField() const {
+    ElementType* GetField() const {
         return field_;
     }
 
@@ -234,25 +286,206 @@ public:
     }
 
 private:
+    static void ReleaseDeferred(void* block, size_t count) {
+        static_cast<BaseBlock*>(block)->template DecStrongRef<Policy>(count);
+    }
+
+    // An array owner takes pointers from `new[]`, which have to go back through `delete[]`.
+    template <class U>
+    static BaseBlock* NewBlock(U* ptr) {
+        if constexpr (std::is_array_v<T>) {
+            return DeleterBlock<U, std::default_delete<U[]>, std::allocator<U>>::Create(
+                ptr, std::default_delete<U[]>(), std::allocator<U>());
+        } else {
+            return new ControlBlock<U>(ptr);
+        }
+    }
+
     BaseBlock* block_ = nullptr;
-    T* field_ = nullptr;
+    ElementType* field_ = nullptr;
 
     template <typename U, typename... Args>
+        requires(!std::is_array_v<U>)
     friend SharedPtr<U> MakeShared(Args&&... args);
+
+    template <typename U, typename... Args>
+        requires(!std::is_array_v<U>)
+    friend LocalSharedPtr<U> MakeLocalShared(Args&&... args);
+
+    template <typename U>
+        requires std::is_unbounded_array_v<U>
+    friend SharedPtr<U> MakeShared(size_t size);
+
+    template <typename U>
+        requires std::is_bounded_array_v<U>
+    friend SharedPtr<U> MakeShared();
+
+    template <typename U>
+        requires(!std::is_array_v<U>)
+    friend SharedPtr<U> MakeSharedForOverwrite();
+
+    template <typename U>
+        requires std::is_unbounded_array_v<U>
+    friend SharedPtr<U> MakeSharedForOverwrite(size_t size);
+
+    template <typename U>
+        requires std::is_bounded_array_v<U>
+    friend SharedPtr<U> MakeSharedForOverwrite();
+
+    template <typename U, typename... Args>
+    friend SharedPtr<U> MakeBiasedShared(Args&&... args);
+
+    template <typename U, typename Alloc, typename... Args>
+    friend SharedPtr<U> AllocateShared(const Alloc& alloc, Args&&... args);
 };
 
-template <typename T, typename U>
-inline bool operator==(const SharedPtr<T>& left, const SharedPtr<U>& right);
+template <typename T, typename U, typename Policy>
+inline bool operator==(const SharedPtr<T, Policy>& left, const SharedPtr<U, Policy>& right);
 
-// Allocate memory only once
+// Split storage: the object and a pooled `ControlBlock` are allocated separately, and the object's
+// memory is freed together with the object while weak references only pin the small block.
 template <typename T, typename... Args>
+    requires(!std::is_array_v<T>)
+SharedPtr<T> MakeSplitShared(Args&&... args) {
+    return SharedPtr<T>(new T(std::forward<Args>(args)...));
+}
+
+// Allocate memory only once, unless the object is large enough to be worth splitting off
+template <typename T, typename... Args>
+    requires(!std::is_array_v<T>)
 SharedPtr<T> MakeShared(Args&&... args) {
-    auto block = new Block<T>(std::forward<Args>(args)...);
+    if constexpr (sizeof(T) > kSplitStorageThreshold) {
+        return MakeSplitShared<T>(std::forward<Args>(args)...);
+    } else {
+        auto block = new Block<T>(std::forward<Args>(args)...);
+        SharedPtr<T> obj;
+        obj.block_ = block;
+        obj.field_ = block->GetPtr();
+        obj.AddStrongRef();
+        return obj;
+    }
+}
+
+// `MakeShared` for thread-confined objects.
+template <typename T, typename... Args>
+    requires(!std::is_array_v<T>)
+LocalSharedPtr<T> MakeLocalShared(Args&&... args) {
+    if constexpr (sizeof(T) > kSplitStorageThreshold) {
+        return LocalSharedPtr<T>(new T(std::forward<Args>(args)...));
+    } else {
+        auto block = new Block<T>(std::forward<Args>(args)...);
+        LocalSharedPtr<T> obj;
+        obj.block_ = block;
+        obj.field_ = block->GetPtr();
+        obj.AddStrongRef();
+        return obj;
+    }
+}
+
+// `size` value-initialized elements stored right after the control block.
+template <typename T>
+    requires std::is_unbounded_array_v<T>
+SharedPtr<T> MakeShared(size_t size) {
+    auto block = ArrayBlock<std::remove_extent_t<T>>::Create(size);
     SharedPtr<T> obj;
     obj.block_ = block;
     obj.field_ = block->GetPtr();
     obj.AddStrongRef();
-    return std::move(obj);
+    return obj;
+}
+
+template <typename T>
+    requires std::is_bounded_array_v<T>
+SharedPtr<T> MakeShared() {
+    auto block = ArrayBlock<std::remove_extent_t<T>>::Create(std::extent_v<T>);
+    SharedPtr<T> obj;
+    obj.block_ = block;
+    obj.field_ = block->GetPtr();
+    obj.AddStrongRef();
+    return obj;
+}
+
+// The for-overwrite factories default-initialize: trivially constructible objects and elements
+// keep whatever the allocation held, for buffers that are filled right away.
+template <typename T>
+    requires(!std::is_array_v<T>)
+SharedPtr<T> MakeSharedForOverwrite() {
+    if constexpr (sizeof(T) > kSplitStorageThreshold) {
+        return SharedPtr<T>(new T);
+    } else {
+        auto block = new Block<T>(ForOverwrite{});
+        SharedPtr<T> obj;
+        obj.block_ = block;
+        obj.field_ = block->GetPtr();
+        obj.AddStrongRef();
+        return obj;
+    }
+}
+
+template <typename T>
+    requires std::is_unbounded_array_v<T>
+SharedPtr<T> MakeSharedForOverwrite(size_t size) {
+    auto block = ArrayBlock<std::remove_extent_t<T>>::Create(size, ForOverwrite{});
+    SharedPtr<T> obj;
+    obj.block_ = block;
+    obj.field_ = block->GetPtr();
+    obj.AddStrongRef();
+    return obj;
+}
+
+template <typename T>
+    requires std::is_bounded_array_v<T>
+SharedPtr<T> MakeSharedForOverwrite() {
+    auto block = ArrayBlock<std::remove_extent_t<T>>::Create(std::extent_v<T>, ForOverwrite{});
+    SharedPtr<T> obj;
+    obj.block_ = block;
+    obj.field_ = block->GetPtr();
+    obj.AddStrongRef();
+    return obj;
+}
+
+// Same single allocation, but copies made on the calling thread skip atomics: the block uses
+// biased reference counting. Pays off when almost every copy stays on the creating thread.
+template <typename T, typename... Args>
+SharedPtr<T> MakeBiasedShared(Args&&... args) {
+    auto block = new BiasedBlock<T>(std::forward<Args>(args)...);
+    SharedPtr<T> obj;
+    obj.block_ = block;
+    obj.field_ = block->GetPtr();
+    obj.AddStrongRef();
+    return obj;
+}
+
+// Like `MakeShared`, but the single allocation comes from `alloc`, which is kept in the control
+// block to release it.
+template <typename T, typename Alloc, typename... Args>
+SharedPtr<T> AllocateShared(const Alloc& alloc, Args&&... args) {
+    auto block = AllocatedBlock<T, Alloc>::Create(alloc, std::forward<Args>(args)...);
+    SharedPtr<T> obj;
+    obj.block_ = block;
+    obj.field_ = block->GetPtr();
+    obj.AddStrongRef();
+    return obj;
+}
+
+// `MakeShared` with the block taken from the calling thread's magazines, see
+// common/magazine.h. Meant for objects that are created on one thread and released on another.
+template <typename T, typename... Args>
+    requires(!std::is_array_v<T>)
+SharedPtr<T> MakePooledShared(Args&&... args) {
+    return AllocateShared<T>(MagazineAllocator<T>(), std::forward<Args>(args)...);
+}
+
+// Makes the object immortal: it is never destroyed, and copying or destroying pointers to it no
+// longer touches the reference counts. Meant for process-wide singletons shared by many threads.
+template <typename T, typename Policy>
+SharedPtr<T, Policy> MakeImmortal(SharedPtr<T, Policy> ptr) {
+    if (BaseBlock* block = ptr.GetBlock()) {
+        // The reference that keeps the object alive forever.
+        block->template AddStrongRef<Policy>();
+        block->MakeImmortal();
+    }
+    return ptr;
 }
 
 // Look for usage examples in tests
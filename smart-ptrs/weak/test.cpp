@@ -5,6 +5,10 @@
 
 #include <catch.hpp>
 
+#include <atomic>
+#include <thread>
+#include <vector>
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 TEST_CASE("Empty weak") {
@@ -163,3 +167,140 @@ TEST_CASE("Lifetimes") {
         delete wp;
     }
 }
+
+TEST_CASE("Concurrent Lock") {
+    constexpr int kThreads = 4;
+    constexpr int kIterations = 1000;
+
+    std::atomic<int> wrong_values = 0;
+    for (int i = 0; i < kIterations; ++i) {
+        auto shared = MakeShared<MyInt>(i);
+        WeakPtr<MyInt> weak(shared);
+        std::vector<std::thread> threads;
+        for (int j = 0; j < kThreads; ++j) {
+            threads.emplace_back([weak, i, &wrong_values] {
+                if (auto locked = weak.Lock(); locked && !(*locked == i)) {
+                    ++wrong_values;
+                }
+            });
+        }
+        shared.Reset();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(weak.Expired());
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+    REQUIRE(wrong_values == 0);
+}
+
+TEST_CASE("Biased Lock") {
+    WeakPtr<MyInt> weak;
+    {
+        auto shared = MakeBiasedShared<MyInt>(7);
+        weak = shared;
+        size_t use_count = 0;
+        std::thread([weak, &use_count] { use_count = weak.Lock().UseCount(); }).join();
+        REQUIRE(use_count == 2);
+        REQUIRE(weak.Lock().UseCount() == 2);
+    }
+    REQUIRE(weak.Expired());
+    REQUIRE(MyInt::AliveCount() == 0);
+}
+
+TEST_CASE("Weak arrays") {
+    WeakPtr<MyInt[]> weak;
+    {
+        SharedPtr<MyInt[]> shared = MakeShared<MyInt[]>(3);
+        weak = shared;
+        REQUIRE(MyInt::AliveCount() == 3);
+        SharedPtr<MyInt[]> locked = weak.Lock();
+        REQUIRE(locked.Get() == shared.Get());
+        REQUIRE(locked.UseCount() == 2);
+    }
+    REQUIRE(weak.Expired());
+    REQUIRE(MyInt::AliveCount() == 0);
+}
+
+// Counts the memory taken by its own allocations.
+struct Payload {
+    explicit Payload(int value = 0) : value(value) {
+    }
+
+    static void* operator new(size_t size) {
+        allocated += size;
+        return ::operator new(size);
+    }
+
+    static void operator delete(void* ptr, size_t size) {
+        allocated -= size;
+        ::operator delete(ptr);
+    }
+
+    int value;
+
+    static inline size_t allocated = 0;
+};
+
+struct LargePayload : Payload {
+    using Payload::Payload;
+
+    char bytes[kSplitStorageThreshold];
+};
+
+TEST_CASE("Split storage") {
+    SECTION("Large objects") {
+        WeakPtr<LargePayload> weak;
+        {
+            auto shared = MakeShared<LargePayload>(5);
+            weak = shared;
+            REQUIRE(Payload::allocated == sizeof(LargePayload));
+        }
+        REQUIRE(weak.Expired());
+        REQUIRE(Payload::allocated == 0);
+        REQUIRE(!weak.Lock());
+    }
+
+    SECTION("Explicit") {
+        WeakPtr<Payload> weak;
+        {
+            auto shared = MakeSplitShared<Payload>(3);
+            weak = shared;
+            REQUIRE(weak.Lock()->value == 3);
+            REQUIRE(Payload::allocated == sizeof(Payload));
+        }
+        REQUIRE(Payload::allocated == 0);
+        REQUIRE(weak.Expired());
+    }
+
+    SECTION("Small objects stay embedded") {
+        auto shared = MakeShared<Payload>(1);
+        REQUIRE(Payload::allocated == 0);
+    }
+}
+
+TEST_CASE("Promotion with weak references") {
+    LocalSharedPtr<MyInt> local = MakeLocalShared<MyInt>(1);
+    {
+        LocalWeakPtr<MyInt> weak = local;
+        REQUIRE_THROWS_AS(SharedPtr<MyInt>(std::move(local)), BadPromotion);
+    }
+    SharedPtr<MyInt> shared(std::move(local));
+    WeakPtr<MyInt> weak = shared;
+    REQUIRE(weak.Lock().Get() == shared.Get());
+}
+
+TEST_CASE("Immortal weak references") {
+    auto shared = MakeShared<MyInt>(7);
+    SharedPtr<MyInt> immortal = MakeImmortal(shared);
+    size_t use_count = immortal.UseCount();
+    shared.Reset();
+    WeakPtr<MyInt> weak(immortal);
+    REQUIRE(weak.Lock().UseCount() == use_count);
+    REQUIRE(!weak.Expired());
+    immortal.Reset();
+    // The object is never destroyed; it stays alive (and leaked) for the rest of the run.
+    REQUIRE(!weak.Expired());
+    static WeakPtr<MyInt>* keep = new WeakPtr<MyInt>(weak);
+    REQUIRE(*keep->Lock() == 7);
+}